@@ -0,0 +1,880 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include "gb.h"
+#include "apu.h"
+#include "blip.h"
+#include "sched.h"
+
+/*
+ * Audio processing unit
+ *
+ * The APU is not ticked along with the CPU. It keeps the timestamp it
+ * is caught up to and is only brought up to date when the CPU accesses
+ * a sound register, or when an output frame ends (a scheduler event,
+ * once per video frame). Catching up steps each channel's waveform from
+ * one level change to the next, interleaved with the 512 Hz frame
+ * sequencer (length, sweep, envelope), and hands every change of the
+ * output level to a band-limited step buffer (see blip.c). Channels
+ * that are silent skip their waveform steps in a single division.
+ *
+ * Synthesis can be switched off per instance. Only what the CPU can
+ * observe is emulated then: the frame sequencer still clocks length
+ * timers, the sweep and envelopes when a register access catches up,
+ * but no waveform is stepped and no output frame is scheduled. While
+ * all channels are off and no length timer runs, catching up skips the
+ * sequencer steps at once. A game that never touches sound costs
+ * nothing, and one that does only pays for its register accesses.
+ *
+ * The frame sequencer runs freely from power on instead of following
+ * DIV, so resetting DIV does not shift it.
+ */
+
+#define APU_WAVE_RAM 0xFF30
+#define APU_SAMPLES_PER_CYCLE ((double)APU_DEFAULT_RATE / GB_CLOCK_SPEED_HZ) // Fixed, rate control is done by the resampler
+
+#define NR52_POWER 0x80
+
+static inline uint8_t *apu_reg(struct gb_s *gb, uint16_t loc)
+{
+    return &gb->memory.ram[loc - 0x8000];
+}
+
+static inline uint8_t *apu_channel_reg(struct gb_s *gb, int channel, int reg)
+{
+    return apu_reg(gb, GB_NR10 + channel * 5 + reg);
+}
+
+/* Bits that always read as 1, from NR10 to 0xFF2F */
+static const uint8_t apu_read_mask[0x20] = {
+    0x80, 0x3F, 0x00, 0xFF, 0xBF, // NR10-NR14
+    0xFF, 0x3F, 0x00, 0xFF, 0xBF, // NR21-NR24
+    0x7F, 0xFF, 0x9F, 0xFF, 0xBF, // NR30-NR34
+    0xFF, 0xFF, 0x00, 0x00, 0xBF, // NR41-NR44
+    0x00, 0x00, 0x70,             // NR50-NR52
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+/* Square waveforms, per duty cycle and step */
+static const uint8_t apu_duty[4][8] = {
+    {0, 0, 0, 0, 0, 0, 0, 1}, // 12.5%
+    {1, 0, 0, 0, 0, 0, 0, 1}, // 25%
+    {1, 0, 0, 0, 0, 1, 1, 1}, // 50%
+    {0, 1, 1, 1, 1, 1, 1, 0}, // 75%
+};
+
+/**
+ * @brief Returns the number of T-cycles per waveform step
+ *
+ * @param gb gameboy state struct
+ * @param channel channel index
+ * @return uint32_t T-cycles
+ */
+static uint32_t apu_period(struct gb_s *gb, int channel)
+{
+    struct apu_channel_s *ch = &gb->apu.ch[channel];
+
+    switch (channel)
+    {
+    case APU_WAVE:
+        return (2048 - ch->freq) * 2;
+
+    case APU_NOISE:
+    {
+        uint8_t nr43 = *apu_reg(gb, GB_NR43);
+        uint32_t divisor = nr43 & 0x07 ? (nr43 & 0x07) * 16 : 8;
+        return divisor << (nr43 >> 4);
+    }
+
+    default:
+        return (2048 - ch->freq) * 4;
+    }
+}
+
+/**
+ * @brief Returns the DAC input of a channel
+ *
+ * @param gb gameboy state struct
+ * @param channel channel index
+ * @return int8_t 0-15
+ */
+static inline int8_t apu_channel_amp(struct gb_s *gb, int channel)
+{
+    struct apu_channel_s *ch = &gb->apu.ch[channel];
+
+    if (!ch->on)
+        return 0;
+
+    if (channel == APU_WAVE)
+    {
+        uint8_t code = (*apu_reg(gb, GB_NR32) >> 5) & 0x03;
+        return code ? ch->level >> (code - 1) : 0;
+    }
+
+    return ch->level ? ch->env.volume : 0;
+}
+
+/**
+ * @brief Changes the output level
+ *
+ * @param gb gameboy state struct
+ * @param left change of the left output level
+ * @param right change of the right output level
+ * @param when T-cycle timestamp of the change
+ */
+static inline void apu_output(struct gb_s *gb, int32_t left, int32_t right, uint64_t when)
+{
+    struct apu_s *apu = &gb->apu;
+
+    apu->left += left;
+    apu->right += right;
+
+    if (left || right)
+        blip_add_delta(&apu->blip, when - apu->frame_start, left * APU_VOLUME, right * APU_VOLUME);
+}
+
+/**
+ * @brief Returns the output weights of a channel
+ *
+ * @param gb gameboy state struct
+ * @param channel channel index
+ * @param left receives the left volume, 0 if not panned left
+ * @param right receives the right volume, 0 if not panned right
+ */
+static inline void apu_channel_pan(struct gb_s *gb, int channel, int32_t *left, int32_t *right)
+{
+    uint8_t nr50 = *apu_reg(gb, GB_NR50);
+    uint8_t nr51 = *apu_reg(gb, GB_NR51);
+
+    *left = nr51 & (0x10 << channel) ? ((nr50 >> 4) & 0x07) + 1 : 0;
+    *right = nr51 & (0x01 << channel) ? (nr50 & 0x07) + 1 : 0;
+}
+
+/**
+ * @brief Updates the DAC input of a channel and the output level
+ *
+ * @param gb gameboy state struct
+ * @param channel channel index
+ * @param when T-cycle timestamp of the change
+ */
+static void apu_update_amp(struct gb_s *gb, int channel, uint64_t when)
+{
+    struct apu_channel_s *ch = &gb->apu.ch[channel];
+    int8_t amp = apu_channel_amp(gb, channel);
+    int32_t left, right;
+
+    if (!gb->apu.synth || amp == ch->amp)
+        return;
+
+    apu_channel_pan(gb, channel, &left, &right);
+    apu_output(gb, (amp - ch->amp) * left, (amp - ch->amp) * right, when);
+    ch->amp = amp;
+}
+
+/**
+ * @brief Recomputes the output level after a panning or volume change
+ *
+ * @param gb gameboy state struct
+ * @param when T-cycle timestamp of the change
+ */
+static void apu_remix(struct gb_s *gb, uint64_t when)
+{
+    int32_t left = 0;
+    int32_t right = 0;
+
+    if (!gb->apu.synth)
+        return;
+
+    for (int i = 0; i < APU_NUM_CHANNELS; i++)
+    {
+        int32_t l, r;
+
+        apu_channel_pan(gb, i, &l, &r);
+        left += gb->apu.ch[i].amp * l;
+        right += gb->apu.ch[i].amp * r;
+    }
+
+    apu_output(gb, left - gb->apu.left, right - gb->apu.right, when);
+}
+
+static void apu_channel_off(struct gb_s *gb, int channel, uint64_t when)
+{
+    gb->apu.ch[channel].on = false;
+    apu_update_amp(gb, channel, when);
+}
+
+/**
+ * @brief Advances the waveform of a channel by one step
+ *
+ * @param gb gameboy state struct
+ * @param channel channel index
+ */
+static inline void apu_channel_step(struct gb_s *gb, int channel)
+{
+    struct apu_channel_s *ch = &gb->apu.ch[channel];
+
+    switch (channel)
+    {
+    case APU_WAVE:
+    {
+        ch->pos = (ch->pos + 1) & 31;
+        uint8_t sample = *apu_reg(gb, APU_WAVE_RAM + ch->pos / 2);
+        ch->level = ch->pos & 1 ? sample & 0x0F : sample >> 4;
+        break;
+    }
+
+    case APU_NOISE:
+    {
+        uint16_t lfsr = gb->apu.lfsr;
+        uint16_t bit = (lfsr ^ (lfsr >> 1)) & 1;
+
+        lfsr = (lfsr >> 1) | (bit << 14);
+        if (*apu_reg(gb, GB_NR43) & 0x08)
+            // 7-bit mode
+            lfsr = (lfsr & ~0x40) | (bit << 6);
+
+        gb->apu.lfsr = lfsr;
+        ch->level = ~lfsr & 1;
+        break;
+    }
+
+    default:
+        ch->pos = (ch->pos + 1) & 7;
+        ch->level = apu_duty[*apu_channel_reg(gb, channel, 1) >> 6][ch->pos];
+        break;
+    }
+}
+
+/**
+ * @brief Runs the noise channel up to a timestamp
+ *
+ * Noise is clocked up to half a million times per second, so its state
+ * is kept in locals.
+ *
+ * @param gb gameboy state struct
+ * @param end T-cycle timestamp to run to
+ * @param left left output volume
+ * @param right right output volume
+ */
+static void apu_noise_run(struct gb_s *gb, uint64_t end, int32_t left, int32_t right)
+{
+    struct apu_channel_s *ch = &gb->apu.ch[APU_NOISE];
+    uint16_t lfsr = gb->apu.lfsr;
+    uint16_t narrow = *apu_reg(gb, GB_NR43) & 0x08 ? 0x40 : 0; // 7-bit mode
+    int8_t volume = ch->env.volume;
+    int8_t amp = ch->amp;
+    uint64_t next = ch->next;
+
+    for (; next <= end; next += ch->period)
+    {
+        uint16_t bit = (lfsr ^ (lfsr >> 1)) & 1;
+
+        lfsr = (lfsr >> 1) | (bit << 14);
+        lfsr = (lfsr & ~narrow) | ((bit << 6) & narrow);
+
+        int8_t level = lfsr & 1 ? 0 : volume;
+        if (level != amp)
+        {
+            apu_output(gb, (level - amp) * left, (level - amp) * right, next);
+            amp = level;
+        }
+    }
+
+    gb->apu.lfsr = lfsr;
+    ch->level = ~lfsr & 1;
+    ch->amp = amp;
+    ch->next = next;
+}
+
+/**
+ * @brief Runs the waveform of a channel up to a timestamp
+ *
+ * The envelope only changes on frame sequencer steps, so a channel that
+ * is silent now stays silent until the end.
+ *
+ * @param gb gameboy state struct
+ * @param channel channel index
+ * @param end T-cycle timestamp to run to, at most the next frame sequencer step
+ */
+static void apu_channel_run(struct gb_s *gb, int channel, uint64_t end)
+{
+    struct apu_channel_s *ch = &gb->apu.ch[channel];
+
+    if (!ch->on || ch->next > end)
+        return;
+
+    bool silent = channel == APU_WAVE ? !(*apu_reg(gb, GB_NR32) & 0x60) : !ch->env.volume;
+
+    if (silent)
+    {
+        uint64_t steps = (end - ch->next) / ch->period + 1;
+
+        ch->next += steps * ch->period;
+        if (channel != APU_NOISE)
+        {
+            // Keep the phase, the noise LFSR does not matter while silent
+            ch->pos = (ch->pos + steps - 1) & (channel == APU_WAVE ? 31 : 7);
+            apu_channel_step(gb, channel);
+        }
+        return;
+    }
+
+    // Panning only changes on register writes, which catch up first
+    int32_t left, right;
+    apu_channel_pan(gb, channel, &left, &right);
+
+    if (channel == APU_NOISE)
+    {
+        apu_noise_run(gb, end, left, right);
+        return;
+    }
+
+    while (ch->next <= end)
+    {
+        apu_channel_step(gb, channel);
+
+        int8_t amp = apu_channel_amp(gb, channel);
+        if (amp != ch->amp)
+        {
+            apu_output(gb, (amp - ch->amp) * left, (amp - ch->amp) * right, ch->next);
+            ch->amp = amp;
+        }
+
+        ch->next += ch->period;
+    }
+}
+
+/**
+ * @brief Computes the next channel 1 sweep frequency
+ *
+ * Overflowing disables the channel.
+ *
+ * @param gb gameboy state struct
+ * @param when T-cycle timestamp
+ * @return uint16_t new frequency, above 2047 on overflow
+ */
+static uint16_t apu_sweep_calc(struct gb_s *gb, uint64_t when)
+{
+    uint8_t nr10 = *apu_reg(gb, GB_NR10);
+    uint16_t shadow = gb->apu.sweep_shadow;
+    uint16_t offset = shadow >> (nr10 & 0x07);
+    uint16_t freq = nr10 & 0x08 ? shadow - offset : shadow + offset;
+
+    if (freq > 2047)
+        apu_channel_off(gb, APU_SQUARE1, when);
+
+    return freq;
+}
+
+static void apu_sweep_step(struct gb_s *gb, uint64_t when)
+{
+    struct apu_s *apu = &gb->apu;
+    uint8_t nr10 = *apu_reg(gb, GB_NR10);
+    uint8_t pace = (nr10 >> 4) & 0x07;
+
+    if (apu->sweep_timer > 1)
+    {
+        apu->sweep_timer--;
+        return;
+    }
+
+    apu->sweep_timer = pace ? pace : 8;
+
+    if (!apu->sweep_enabled || !pace)
+        return;
+
+    uint16_t freq = apu_sweep_calc(gb, when);
+
+    if (freq <= 2047 && (nr10 & 0x07))
+    {
+        struct apu_channel_s *ch = &apu->ch[APU_SQUARE1];
+
+        apu->sweep_shadow = freq;
+        ch->freq = freq;
+        ch->period = apu_period(gb, APU_SQUARE1);
+        *apu_reg(gb, GB_NR13) = freq & 0xFF;
+        *apu_reg(gb, GB_NR14) = (*apu_reg(gb, GB_NR14) & ~0x07) | (freq >> 8);
+
+        // Checked again with the new frequency
+        apu_sweep_calc(gb, when);
+    }
+}
+
+static void apu_envelope_step(struct gb_s *gb, int channel, uint64_t when)
+{
+    struct apu_envelope_s *env = &gb->apu.ch[channel].env;
+
+    if (!env->pace)
+        return;
+
+    if (env->timer > 1)
+    {
+        env->timer--;
+        return;
+    }
+
+    env->timer = env->pace;
+
+    if (env->up && env->volume < 15)
+        env->volume++;
+    else if (!env->up && env->volume > 0)
+        env->volume--;
+    else
+        return;
+
+    apu_update_amp(gb, channel, when);
+}
+
+/**
+ * @brief Runs a frame sequencer step
+ *
+ * Length timers are clocked on even steps, the sweep on steps 2 and 6,
+ * envelopes on step 7.
+ *
+ * @param gb gameboy state struct
+ * @param when T-cycle timestamp of the step
+ */
+static void apu_sequencer_step(struct gb_s *gb, uint64_t when)
+{
+    struct apu_s *apu = &gb->apu;
+    uint8_t step = apu->seq_step;
+
+    apu->seq_step = (step + 1) & 7;
+
+    if (!(*apu_reg(gb, GB_NR52) & NR52_POWER))
+        return;
+
+    if (!(step & 1))
+    {
+        for (int i = 0; i < APU_NUM_CHANNELS; i++)
+        {
+            struct apu_channel_s *ch = &apu->ch[i];
+
+            if (ch->length_enable && ch->length && !--ch->length)
+                apu_channel_off(gb, i, when);
+        }
+    }
+
+    if (step == 2 || step == 6)
+        apu_sweep_step(gb, when);
+
+    if (step == 7)
+    {
+        apu_envelope_step(gb, APU_SQUARE1, when);
+        apu_envelope_step(gb, APU_SQUARE2, when);
+        apu_envelope_step(gb, APU_NOISE, when);
+    }
+}
+
+/**
+ * @brief Checks whether the frame sequencer has anything to do
+ *
+ * @param apu APU state
+ * @return true if all channels are off and no length timer runs
+ */
+static bool apu_idle(const struct apu_s *apu)
+{
+    for (int i = 0; i < APU_NUM_CHANNELS; i++)
+    {
+        const struct apu_channel_s *ch = &apu->ch[i];
+
+        if (ch->on || (ch->length_enable && ch->length))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Catches the APU up to a timestamp
+ *
+ * @param gb gameboy state struct
+ * @param until T-cycle timestamp to run to
+ */
+void apu_run(struct gb_s *gb, uint64_t until)
+{
+    struct apu_s *apu = &gb->apu;
+
+    while (apu->last < until)
+    {
+        uint64_t end = until < apu->seq_next ? until : apu->seq_next;
+
+        if (!apu->synth && apu_idle(apu))
+        {
+            // Nothing observable changes until the next trigger
+            uint64_t steps = until >= apu->seq_next ? (until - apu->seq_next) / APU_SEQ_CYCLES + 1 : 0;
+
+            apu->seq_step = (apu->seq_step + steps) & 7;
+            apu->seq_next += steps * APU_SEQ_CYCLES;
+            apu->last = until;
+            break;
+        }
+
+        for (int i = 0; apu->synth && i < APU_NUM_CHANNELS; i++)
+            apu_channel_run(gb, i, end);
+
+        apu->last = end;
+
+        if (end == apu->seq_next)
+        {
+            apu_sequencer_step(gb, end);
+            apu->seq_next += APU_SEQ_CYCLES;
+        }
+    }
+}
+
+/**
+ * @brief Starts a channel (NRx4 bit 7)
+ *
+ * @param gb gameboy state struct
+ * @param channel channel index
+ * @param when T-cycle timestamp
+ */
+static void apu_trigger(struct gb_s *gb, int channel, uint64_t when)
+{
+    struct apu_s *apu = &gb->apu;
+    struct apu_channel_s *ch = &apu->ch[channel];
+
+    ch->on = ch->dac;
+
+    if (!ch->length)
+        ch->length = channel == APU_WAVE ? 256 : 64;
+
+    ch->period = apu_period(gb, channel);
+    ch->next = when + ch->period;
+
+    if (channel == APU_WAVE)
+    {
+        ch->pos = 0;
+    }
+    else
+    {
+        uint8_t nrx2 = *apu_channel_reg(gb, channel, 2);
+
+        ch->env.volume = nrx2 >> 4;
+        ch->env.up = nrx2 & 0x08;
+        ch->env.pace = nrx2 & 0x07;
+        ch->env.timer = ch->env.pace;
+    }
+
+    if (channel == APU_NOISE)
+        apu->lfsr = 0x7FFF;
+
+    if (channel == APU_SQUARE1)
+    {
+        uint8_t nr10 = *apu_reg(gb, GB_NR10);
+        uint8_t pace = (nr10 >> 4) & 0x07;
+
+        apu->sweep_shadow = ch->freq;
+        apu->sweep_timer = pace ? pace : 8;
+        apu->sweep_enabled = pace || (nr10 & 0x07);
+
+        if (nr10 & 0x07)
+            apu_sweep_calc(gb, when);
+    }
+
+    apu_update_amp(gb, channel, when);
+}
+
+/**
+ * @brief Handles a write to NR52
+ *
+ * Powering off clears all sound registers, wave RAM is kept.
+ *
+ * @param gb gameboy state struct
+ * @param data byte written
+ * @param when T-cycle timestamp
+ */
+static void apu_write_power(struct gb_s *gb, uint8_t data, uint64_t when)
+{
+    struct apu_s *apu = &gb->apu;
+    bool was_on = *apu_reg(gb, GB_NR52) & NR52_POWER;
+
+    *apu_reg(gb, GB_NR52) = data & NR52_POWER;
+
+    if (was_on && !(data & NR52_POWER))
+    {
+        memset(apu_reg(gb, GB_NR10), 0, GB_NR52 - GB_NR10);
+
+        for (int i = 0; i < APU_NUM_CHANNELS; i++)
+        {
+            struct apu_channel_s *ch = &apu->ch[i];
+
+            ch->on = false;
+            ch->dac = false;
+            ch->length_enable = false;
+            ch->freq = 0;
+            memset(&ch->env, 0, sizeof(ch->env));
+            apu_update_amp(gb, i, when);
+        }
+
+        apu->sweep_enabled = false;
+        apu_remix(gb, when);
+    }
+    else if (!was_on && (data & NR52_POWER))
+    {
+        apu->seq_step = 0;
+        apu->ch[APU_SQUARE1].pos = 0;
+        apu->ch[APU_SQUARE2].pos = 0;
+    }
+}
+
+/**
+ * @brief Read byte from a sound register or wave RAM
+ *
+ * @param gb gameboy state struct
+ * @param loc address from NR10 to the end of wave RAM
+ * @return uint8_t register value
+ */
+uint8_t apu_read(struct gb_s *gb, uint16_t loc)
+{
+    if (loc >= APU_WAVE_RAM)
+        return *apu_reg(gb, loc);
+
+    if (loc == GB_NR52)
+    {
+        uint8_t value = *apu_reg(gb, GB_NR52) | 0x70;
+
+        // Length timers and the sweep may have stopped channels since
+        apu_run(gb, gb->clock);
+
+        for (int i = 0; i < APU_NUM_CHANNELS; i++)
+        {
+            if (gb->apu.ch[i].on)
+                value |= 1 << i;
+        }
+
+        return value;
+    }
+
+    return *apu_reg(gb, loc) | apu_read_mask[loc - GB_NR10];
+}
+
+/**
+ * @brief Write byte to a sound register or wave RAM
+ *
+ * @param gb gameboy state struct
+ * @param loc address from NR10 to the end of wave RAM
+ * @param data byte to write
+ */
+void apu_write(struct gb_s *gb, uint16_t loc, uint8_t data)
+{
+    struct apu_s *apu = &gb->apu;
+
+    apu_run(gb, gb->clock);
+
+    uint64_t when = apu->last;
+
+    if (loc >= APU_WAVE_RAM)
+    {
+        *apu_reg(gb, loc) = data;
+        return;
+    }
+
+    if (loc == GB_NR52)
+    {
+        apu_write_power(gb, data, when);
+        return;
+    }
+
+    if (!(*apu_reg(gb, GB_NR52) & NR52_POWER))
+        // Registers are read-only while powered off
+        return;
+
+    *apu_reg(gb, loc) = data;
+
+    if (loc == GB_NR50 || loc == GB_NR51)
+    {
+        apu_remix(gb, when);
+        return;
+    }
+
+    if (loc > GB_NR52)
+        return;
+
+    int channel = (loc - GB_NR10) / 5;
+    struct apu_channel_s *ch = &apu->ch[channel];
+
+    switch ((loc - GB_NR10) % 5)
+    {
+    case 1: // Length timer
+        ch->length = channel == APU_WAVE ? 256 - data : 64 - (data & 0x3F);
+        break;
+
+    case 2: // Volume & envelope, or NR32 output level
+        if (channel == APU_WAVE)
+        {
+            apu_update_amp(gb, channel, when);
+            break;
+        }
+
+        ch->dac = data & 0xF8;
+        if (!ch->dac)
+            apu_channel_off(gb, channel, when);
+        break;
+
+    case 3: // Period low, or NR43 noise frequency
+        if (channel != APU_NOISE)
+            ch->freq = (ch->freq & 0x700) | data;
+        ch->period = apu_period(gb, channel);
+        break;
+
+    case 4: // Period high & control
+        ch->length_enable = data & 0x40;
+
+        if (channel != APU_NOISE)
+        {
+            ch->freq = (ch->freq & 0xFF) | ((data & 0x07) << 8);
+            ch->period = apu_period(gb, channel);
+        }
+
+        if (data & 0x80)
+            apu_trigger(gb, channel, when);
+        break;
+
+    default: // NR10 or NR30
+        if (channel == APU_WAVE)
+        {
+            ch->dac = data & 0x80;
+            if (!ch->dac)
+                apu_channel_off(gb, channel, when);
+        }
+        break;
+    }
+}
+
+/**
+ * @brief Ends the current output frame, its samples become readable
+ *
+ * Samples nobody read are dropped once half the buffer is full.
+ *
+ * @param gb gameboy state struct
+ * @param when T-cycle timestamp of the end of the frame
+ */
+static void apu_end_frame(struct gb_s *gb, uint64_t when)
+{
+    struct apu_s *apu = &gb->apu;
+
+    apu_run(gb, when);
+
+    if (when < apu->last)
+        when = apu->last;
+
+    blip_end_frame(&apu->blip, when - apu->frame_start);
+
+    if (apu->blip.avail > BLIP_SIZE / 2)
+        blip_read(&apu->blip, NULL, apu->blip.avail);
+
+    apu->frame_start = when;
+}
+
+void apu_frame_event(struct gb_s *gb, uint64_t when)
+{
+    if (!gb->apu.synth)
+        // Switched off in the meantime
+        return;
+
+    apu_end_frame(gb, when);
+    sched_add(gb, SCHED_APU_FRAME, when + GB_FRAME_CYCLES);
+}
+
+/**
+ * @brief Reads the samples produced up to now
+ *
+ * @param gb gameboy state struct
+ * @param out receives interleaved left/right samples, NULL to discard them
+ * @param max maximum number of stereo samples
+ * @return uint32_t stereo samples read
+ */
+uint32_t apu_read_samples(struct gb_s *gb, int16_t *out, uint32_t max)
+{
+    struct apu_s *apu = &gb->apu;
+
+    if (!apu->synth)
+        return 0;
+
+    apu_end_frame(gb, gb->clock);
+
+    return blip_read(&apu->blip, out, max);
+}
+
+/**
+ * @brief Switches sound synthesis on or off
+ *
+ * Switching it on rebuilds the synthesis state from the registers: the
+ * waveforms restart at the current time and output starts from silence.
+ *
+ * @param gb gameboy state struct
+ * @param enabled synthesize sound, otherwise only emulate what the CPU can observe
+ */
+void apu_set_synth(struct gb_s *gb, bool enabled)
+{
+    struct apu_s *apu = &gb->apu;
+
+    if (enabled == apu->synth)
+        return;
+
+    apu_run(gb, gb->clock);
+    apu->synth = enabled;
+
+    if (!enabled)
+    {
+        sched_remove(gb, SCHED_APU_FRAME);
+        return;
+    }
+
+    uint64_t when = apu->last;
+
+    blip_init(&apu->blip, APU_SAMPLES_PER_CYCLE);
+    apu->frame_start = when;
+    apu->left = 0;
+    apu->right = 0;
+
+    for (int i = 0; i < APU_NUM_CHANNELS; i++)
+    {
+        struct apu_channel_s *ch = &apu->ch[i];
+
+        ch->period = apu_period(gb, i);
+        ch->next = when + ch->period;
+        ch->amp = 0;
+        apu_update_amp(gb, i, when);
+    }
+
+    sched_add(gb, SCHED_APU_FRAME, when + GB_FRAME_CYCLES);
+}
+
+void apu_init(struct gb_s *gb)
+{
+    struct apu_s *apu = &gb->apu;
+
+    // Post boot ROM register state
+    static const uint8_t regs[] = {
+        0x80, 0xBF, 0xF3, 0xFF, 0xBF, // NR10-NR14
+        0xFF, 0x3F, 0x00, 0xFF, 0xBF, // NR21-NR24
+        0x7F, 0xFF, 0x9F, 0xFF, 0xBF, // NR30-NR34
+        0xFF, 0xFF, 0x00, 0x00, 0xBF, // NR41-NR44
+        0x77, 0xF3, 0x80,             // NR50-NR52
+    };
+
+    memset(apu, 0, sizeof(*apu));
+    memcpy(apu_reg(gb, GB_NR10), regs, sizeof(regs));
+
+    // The boot sound has faded out, but channel 1 is still on
+    apu->ch[APU_SQUARE1].on = true;
+    apu->ch[APU_SQUARE1].dac = true;
+    apu->ch[APU_SQUARE1].freq = 0x7C1;
+    apu->ch[APU_SQUARE1].env.pace = 3;
+
+    for (int i = 0; i < APU_NUM_CHANNELS; i++)
+    {
+        apu->ch[i].period = apu_period(gb, i);
+        apu->ch[i].next = apu->ch[i].period;
+    }
+
+    apu->lfsr = 0x7FFF;
+    apu->seq_next = APU_SEQ_CYCLES;
+    apu->synth = true;
+    blip_init(&apu->blip, APU_SAMPLES_PER_CYCLE);
+
+    sched_add(gb, SCHED_APU_FRAME, GB_FRAME_CYCLES);
+}
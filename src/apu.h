@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "blip.h"
+
+/* Constants */
+#define APU_NUM_CHANNELS 4
+#define APU_SEQ_CYCLES 8192 // T-cycles per frame sequencer step (512 Hz)
+#define APU_VOLUME 64       // Output units per DAC step, 4 channels at full volume stay below INT16_MAX
+#define APU_DEFAULT_RATE 48000 // Output sample rate
+
+/* Channels */
+enum
+{
+    APU_SQUARE1,
+    APU_SQUARE2,
+    APU_WAVE,
+    APU_NOISE
+};
+
+/* Volume envelope */
+struct apu_envelope_s
+{
+    uint8_t volume; // Current volume, 0-15
+    uint8_t pace;   // Sequencer steps per volume change, 0 stops the envelope
+    uint8_t timer;  // Steps left until the next volume change
+    bool up;        // Increase instead of decrease
+};
+
+/* Channel state */
+struct apu_channel_s
+{
+    bool on;            // Reported in NR52
+    bool dac;           // DAC powered, the channel is silent and can't be triggered without it
+    bool length_enable; // Length timer stops the channel when it expires
+    uint16_t length;    // Length timer steps left
+    uint16_t freq;      // 11-bit period value
+    uint32_t period;    // T-cycles per waveform step
+    uint64_t next;      // Timestamp of the next waveform step
+    uint8_t pos;        // Duty step or wave RAM sample position
+    uint8_t level;      // Waveform output before volume: 0/1, or a wave sample
+    int8_t amp;         // Current DAC input, 0-15
+    struct apu_envelope_s env;
+};
+
+/* APU state */
+struct apu_s
+{
+    struct apu_channel_s ch[APU_NUM_CHANNELS];
+    uint16_t sweep_shadow; // Channel 1 frequency the sweep works on
+    uint8_t sweep_timer;   // Sequencer steps until the next sweep
+    bool sweep_enabled;
+    uint16_t lfsr;         // Noise shift register
+    uint8_t seq_step;      // Frame sequencer step, 0-7
+    uint64_t seq_next;     // Timestamp of the next frame sequencer step
+    uint64_t last;         // Timestamp the APU is caught up to
+    uint64_t frame_start;  // Timestamp of the start of the current output frame
+    int32_t left;          // Current output level, left
+    int32_t right;         // Current output level, right
+    bool synth;            // Sound is synthesized, otherwise only what the CPU can observe is emulated
+    struct blip_s blip;    // Stereo output
+};
+
+struct gb_s;
+
+void apu_init(struct gb_s *gb);
+void apu_run(struct gb_s *gb, uint64_t until);
+uint8_t apu_read(struct gb_s *gb, uint16_t loc);
+void apu_write(struct gb_s *gb, uint16_t loc, uint8_t data);
+void apu_frame_event(struct gb_s *gb, uint64_t when);
+void apu_set_synth(struct gb_s *gb, bool enabled);
+uint32_t apu_read_samples(struct gb_s *gb, int16_t *out, uint32_t max);
@@ -0,0 +1,209 @@
+#include <math.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include "SDL.h"
+#include "apu.h"
+#include "audio_out.h"
+#include "drc.h"
+#include "resample.h"
+#include "spsc.h"
+
+/*
+ * Audio output
+ *
+ * The emulation thread hands over the APU's samples once per frame.
+ * They are resampled by the ratio dynamic rate control picks, so a
+ * frame of emulated cycles turns into slightly more or fewer samples
+ * while the APU itself always runs at its nominal rate. Samples go
+ * through a lock-free ring to the SDL audio callback. The ring is kept
+ * at the target fill, so latency stays bounded and neither side has to
+ * wait on the other. Only when the emulation runs far ahead of the
+ * audio device (e.g. a host timer running fast) does the producer
+ * wait, which then slaves the emulation speed to the audio clock.
+ */
+
+#define AUDIO_OUT_DEVICE_SAMPLES 512
+#define AUDIO_OUT_CHUNK 256 // Samples resampled at a time
+
+static void audio_out_callback(void *ctx, uint8_t *stream, int len)
+{
+    struct audio_out_s *out = ctx;
+    struct audio_frame_s *frames = (struct audio_frame_s *)stream;
+    int count = len / (int)sizeof(*frames);
+    int i = (int)spsc_pop_n(&out->ring, frames, count);
+
+    if (i < count)
+    {
+        // Ran dry, the producer fills the buffer up again
+        memset(&frames[i], 0, (count - i) * sizeof(*frames));
+        atomic_fetch_add_explicit(&out->underruns, count - i, memory_order_relaxed);
+        atomic_store_explicit(&out->starved, true, memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Opens the default audio device
+ *
+ * Playback starts once the buffer has been filled to the target.
+ *
+ * @param out audio output state
+ * @param latency_ms buffer fill to regulate to, in milliseconds
+ * @return int 0 on success
+ */
+int audio_out_open(struct audio_out_s *out, unsigned latency_ms)
+{
+    SDL_AudioSpec want = {0};
+    SDL_AudioSpec have;
+
+    memset(out, 0, sizeof(*out));
+
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0)
+    {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't initialize audio: %s", SDL_GetError());
+        return -1;
+    }
+
+    want.freq = AUDIO_OUT_RATE;
+    want.format = AUDIO_S16SYS;
+    want.channels = 2;
+    want.samples = AUDIO_OUT_DEVICE_SAMPLES;
+    want.callback = audio_out_callback;
+    want.userdata = out;
+
+    out->rate = AUDIO_OUT_RATE;
+    out->target = out->rate * latency_ms / 1000;
+    if (out->target < AUDIO_OUT_DEVICE_SAMPLES)
+        out->target = AUDIO_OUT_DEVICE_SAMPLES;
+    out->limit = out->target * 2;
+
+    if (spsc_init(&out->ring, sizeof(struct audio_frame_s), out->limit) != 0)
+    {
+        printf("Could not allocate audio buffer\n");
+        return -1;
+    }
+
+    drc_init(&out->drc, APU_DEFAULT_RATE, out->rate, out->target);
+    resample_init(&out->resample, out->drc.base_ratio);
+    atomic_init(&out->starved, false);
+    atomic_init(&out->underruns, 0);
+    atomic_init(&out->overruns, 0);
+    atomic_init(&out->adjust_ppm, 0);
+
+    // SDL converts if the device wants another format
+    out->device = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+    if (!out->device)
+    {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't open audio device: %s", SDL_GetError());
+        spsc_free(&out->ring);
+        return -1;
+    }
+
+    return 0;
+}
+
+void audio_out_close(struct audio_out_s *out)
+{
+    if (!out->device)
+        return;
+
+    SDL_CloseAudioDevice(out->device);
+    spsc_free(&out->ring);
+    out->device = 0;
+}
+
+/**
+ * @brief Returns the number of buffered output samples
+ *
+ * @param out audio output state
+ * @return uint32_t samples not played yet
+ */
+uint32_t audio_out_fill(struct audio_out_s *out)
+{
+    return spsc_count(&out->ring);
+}
+
+/**
+ * @brief Queues samples, waiting while the buffer is at its limit
+ *
+ * @param out audio output state
+ * @param frames samples to queue
+ * @param count number of samples
+ */
+static void audio_out_push(struct audio_out_s *out, const struct audio_frame_s *frames, uint32_t count)
+{
+    uint32_t waited = 0;
+
+    while (count)
+    {
+        uint32_t room = out->limit - audio_out_fill(out);
+        uint32_t pushed = spsc_push_n(&out->ring, frames, count < room ? count : room);
+
+        frames += pushed;
+        count -= pushed;
+
+        if (!count)
+            break;
+
+        if (!out->playing || waited * out->rate >= out->target * 1000)
+        {
+            // Device not consuming, don't block the emulation forever
+            atomic_fetch_add_explicit(&out->overruns, count, memory_order_relaxed);
+            return;
+        }
+
+        SDL_Delay(1);
+        waited++;
+    }
+}
+
+/**
+ * @brief Queues a frame's worth of samples
+ *
+ * Called by the frontend after each emulated frame, with samples at the
+ * APU's nominal rate.
+ *
+ * @param out audio output state
+ * @param frames samples produced by the APU
+ * @param count number of samples
+ */
+void audio_out_write(struct audio_out_s *out, const struct audio_frame_s *frames, uint32_t count)
+{
+    struct audio_frame_s chunk[AUDIO_OUT_CHUNK];
+
+    if (atomic_exchange_explicit(&out->starved, false, memory_order_relaxed))
+    {
+        // Refill to the target at once, the rate control only corrects small drifts
+        memset(chunk, 0, sizeof(chunk));
+        for (uint32_t fill = audio_out_fill(out); fill < out->target; fill = audio_out_fill(out))
+        {
+            uint32_t n = out->target - fill < AUDIO_OUT_CHUNK ? out->target - fill : AUDIO_OUT_CHUNK;
+            audio_out_push(out, chunk, n);
+        }
+    }
+
+    double ratio = drc_update(&out->drc, audio_out_fill(out));
+    resample_set_ratio(&out->resample, ratio);
+    atomic_store_explicit(&out->adjust_ppm, (int_fast32_t)lround((ratio / out->drc.base_ratio - 1.0) * 1e6),
+                          memory_order_relaxed);
+
+    while (count)
+    {
+        uint32_t taken = resample_write(&out->resample, &frames->left, count < AUDIO_OUT_CHUNK ? count : AUDIO_OUT_CHUNK);
+        uint32_t n;
+
+        frames += taken;
+        count -= taken;
+
+        while ((n = resample_read(&out->resample, &chunk[0].left, AUDIO_OUT_CHUNK)) > 0)
+            audio_out_push(out, chunk, n);
+    }
+
+    if (!out->playing && audio_out_fill(out) >= out->target)
+    {
+        SDL_PauseAudioDevice(out->device, 0);
+        out->playing = true;
+    }
+}
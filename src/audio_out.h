@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "SDL.h"
+#include "drc.h"
+#include "resample.h"
+#include "spsc.h"
+
+#define AUDIO_OUT_RATE 48000
+
+/* Stereo output sample */
+struct audio_frame_s
+{
+    int16_t left;
+    int16_t right;
+};
+
+/* Audio output through SDL */
+struct audio_out_s
+{
+    SDL_AudioDeviceID device;
+    uint32_t rate;   // Output sample rate in Hz
+    uint32_t target; // Buffer fill to regulate to, in samples
+    uint32_t limit;  // Buffer fill the producer waits at, in samples
+    bool playing;    // Device unpaused after the initial fill
+
+    struct spsc_s ring;         // struct audio_frame_s, to the audio callback
+    struct drc_s drc;           // Producer only
+    struct resample_s resample; // Producer only, applies the rate control
+    atomic_bool starved;
+
+    atomic_uint_fast32_t underruns; // Samples the callback had to fill with silence
+    atomic_uint_fast32_t overruns;  // Samples dropped because the buffer stayed full
+    atomic_int_fast32_t adjust_ppm; // Rate control deviation from the nominal ratio, published for stats
+};
+
+int audio_out_open(struct audio_out_s *out, unsigned latency_ms);
+void audio_out_close(struct audio_out_s *out);
+void audio_out_write(struct audio_out_s *out, const struct audio_frame_s *frames, uint32_t count);
+uint32_t audio_out_fill(struct audio_out_s *out);
@@ -0,0 +1,209 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include "blip.h"
+
+/*
+ * Band-limited step buffer
+ *
+ * Sound chips output a level that only changes at discrete points in
+ * time. Instead of generating a sample for every clock and filtering,
+ * each level change is stored as a delta: a band-limited impulse (a
+ * windowed sinc, picked from a table by the sub-sample position of the
+ * change) is added to the output buffer, and reading integrates the
+ * buffer back into levels. Synthesis is then paid per level change
+ * rather than per clock, and resampling to the output rate comes for
+ * free. This is the scheme of Shay Green's blip_buf.
+ *
+ * Times are given in clocks since the start of the current frame and
+ * must not lie past its end. The ratio may only change between frames.
+ */
+
+#define BLIP_CUTOFF 0.9 // Of the output Nyquist frequency
+
+static int16_t blip_kernel[BLIP_PHASES][BLIP_WIDTH];
+static pthread_once_t blip_kernel_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Fills a table of band-limited filter phases
+ *
+ * Each phase is a Blackman windowed sinc, shifted by the sub-sample
+ * position and normalized so its taps add up to exactly one unit. That
+ * way the integrated level never drifts and a constant input comes out
+ * unchanged. Shared with the resampler.
+ *
+ * @param kernel receives phases rows of width taps
+ * @param phases sub-sample positions
+ * @param width taps per phase
+ * @param cutoff of the Nyquist frequency
+ * @param bits fixed point precision of the taps
+ */
+void blip_windowed_sinc(int16_t *kernel, int phases, int width, double cutoff, int bits)
+{
+    for (int phase = 0; phase < phases; phase++, kernel += width)
+    {
+        double taps[width];
+        double sum = 0.0;
+
+        for (int i = 0; i < width; i++)
+        {
+            double x = i - (width / 2 - 1) - (double)phase / phases;
+            double sinc = x == 0.0 ? 1.0 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+            double w = 2.0 * M_PI * x / width;
+
+            taps[i] = sinc * (0.42 + 0.5 * cos(w) + 0.08 * cos(2.0 * w));
+            sum += taps[i];
+        }
+
+        int total = 0;
+        int peak = 0;
+
+        for (int i = 0; i < width; i++)
+        {
+            kernel[i] = (int16_t)lround(taps[i] / sum * (1 << bits));
+            total += kernel[i];
+
+            if (kernel[i] > kernel[peak])
+                peak = i;
+        }
+
+        // Rounding error goes to the largest tap
+        kernel[peak] += (1 << bits) - total;
+    }
+}
+
+static void blip_init_kernel(void)
+{
+    blip_windowed_sinc(&blip_kernel[0][0], BLIP_PHASES, BLIP_WIDTH, BLIP_CUTOFF, BLIP_KERNEL_BITS);
+}
+
+/**
+ * @brief Sets up an empty buffer
+ *
+ * @param b buffer
+ * @param samples_per_clock output sample rate divided by the clock rate
+ */
+void blip_init(struct blip_s *b, double samples_per_clock)
+{
+    pthread_once(&blip_kernel_once, blip_init_kernel);
+
+    memset(b, 0, sizeof(*b));
+    blip_set_ratio(b, samples_per_clock);
+}
+
+/**
+ * @brief Changes the output rate, only between frames
+ *
+ * @param b buffer
+ * @param samples_per_clock output sample rate divided by the clock rate
+ */
+void blip_set_ratio(struct blip_s *b, double samples_per_clock)
+{
+    b->factor = (uint64_t)(samples_per_clock * 4294967296.0 + 0.5);
+}
+
+/**
+ * @brief Adds a level change
+ *
+ * @param b buffer
+ * @param time clocks since the start of the frame
+ * @param left level change of the left channel in output sample units
+ * @param right level change of the right channel
+ */
+void blip_add_delta(struct blip_s *b, uint32_t time, int32_t left, int32_t right)
+{
+    uint64_t pos = b->offset + time * b->factor;
+    uint32_t index = pos >> 32;
+    const int16_t *kernel = blip_kernel[(pos >> (32 - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1)];
+
+    if (index > BLIP_SIZE)
+        // Nobody reads the buffer, drop it
+        return;
+
+    int32_t *out = &b->buf[index * 2];
+    for (int i = 0; i < BLIP_WIDTH; i++)
+    {
+        out[i * 2] += left * kernel[i];
+        out[i * 2 + 1] += right * kernel[i];
+    }
+}
+
+/**
+ * @brief Ends the current frame, its samples become readable
+ *
+ * @param b buffer
+ * @param duration length of the frame in clocks
+ */
+void blip_end_frame(struct blip_s *b, uint32_t duration)
+{
+    b->offset += duration * b->factor;
+
+    if ((b->offset >> 32) > BLIP_SIZE)
+        b->offset = (uint64_t)BLIP_SIZE << 32;
+
+    b->avail = b->offset >> 32;
+}
+
+/**
+ * @brief Reads and removes finished samples
+ *
+ * @param b buffer
+ * @param out receives interleaved left/right samples, NULL to discard them
+ * @param count maximum number of stereo samples
+ * @return uint32_t stereo samples read
+ */
+uint32_t blip_read(struct blip_s *b, int16_t *out, uint32_t count)
+{
+    if (count > b->avail)
+        count = b->avail;
+
+    if (!out)
+    {
+        // Nobody listens, keep the level and let the high-pass settle as
+        // if all deltas were at the start
+        double decay = pow(1.0 - 1.0 / (1 << BLIP_BASS_SHIFT), count);
+        int64_t sum[2] = {0, 0};
+
+        for (uint32_t i = 0; i < count * 2; i++)
+            sum[i & 1] += b->buf[i];
+
+        b->integrator[0] = (b->integrator[0] + sum[0]) * decay;
+        b->integrator[1] = (b->integrator[1] + sum[1]) * decay;
+    }
+    else
+    {
+        int64_t left = b->integrator[0];
+        int64_t right = b->integrator[1];
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            left += b->buf[i * 2];
+            right += b->buf[i * 2 + 1];
+
+            int32_t l = (int32_t)(left >> BLIP_KERNEL_BITS);
+            int32_t r = (int32_t)(right >> BLIP_KERNEL_BITS);
+
+            out[i * 2] = l > INT16_MAX ? INT16_MAX : l < INT16_MIN ? INT16_MIN : l;
+            out[i * 2 + 1] = r > INT16_MAX ? INT16_MAX : r < INT16_MIN ? INT16_MIN : r;
+
+            // Leaky integration, a first order high-pass
+            left -= (int64_t)l << (BLIP_KERNEL_BITS - BLIP_BASS_SHIFT);
+            right -= (int64_t)r << (BLIP_KERNEL_BITS - BLIP_BASS_SHIFT);
+        }
+
+        b->integrator[0] = left;
+        b->integrator[1] = right;
+    }
+
+    // Samples still being built up move to the front. Only the used part
+    // is touched, the whole buffer would take up most of the data cache.
+    uint32_t remain = (b->avail - count + BLIP_WIDTH) * 2;
+    memmove(b->buf, &b->buf[count * 2], remain * sizeof(b->buf[0]));
+    memset(&b->buf[remain], 0, count * 2 * sizeof(b->buf[0]));
+
+    b->offset -= (uint64_t)count << 32;
+    b->avail -= count;
+
+    return count;
+}
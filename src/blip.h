@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+#define BLIP_PHASE_BITS 5
+#define BLIP_PHASES (1 << BLIP_PHASE_BITS) // Sub-sample positions of the step kernel
+#define BLIP_WIDTH 16                      // Output samples a step is spread over
+#define BLIP_KERNEL_BITS 12                // Fixed point precision of the kernel
+#define BLIP_BASS_SHIFT 9                  // High-pass strength, removes DC like the output capacitor
+#define BLIP_SIZE 4096                     // Output samples buffered
+
+/* Stereo band-limited step buffer */
+struct blip_s
+{
+    uint64_t factor; // Output samples per clock, 32.32 fixed point
+    uint64_t offset; // Position of the frame start in the buffer, 32.32 fixed point
+    int64_t integrator[2];
+    uint32_t avail;                            // Finished samples, ready to be read
+    int32_t buf[(BLIP_SIZE + BLIP_WIDTH) * 2]; // Interleaved left/right deltas
+};
+
+void blip_init(struct blip_s *b, double samples_per_clock);
+void blip_set_ratio(struct blip_s *b, double samples_per_clock);
+void blip_add_delta(struct blip_s *b, uint32_t time, int32_t left, int32_t right);
+void blip_end_frame(struct blip_s *b, uint32_t duration);
+uint32_t blip_read(struct blip_s *b, int16_t *out, uint32_t count);
+void blip_windowed_sinc(int16_t *kernel, int phases, int width, double cutoff, int bits);
@@ -5,6 +5,7 @@
 #include "cpu.h"
 #include "memory.h"
 #include "opcodes.h"
+#include "sched.h"
 #include "timer.h"
 
 /**
@@ -1529,6 +1530,18 @@ static void stop(struct gb_s *gb)
     // The DIV register is reset when executing STOP
     // see https://gbdev.io/pandocs/Timer_and_Divider_Registers.html
     mem_write_byte(gb, GB_DIV, 0x00);
+
+    uint8_t key1 = mem_read_byte(gb, GB_KEY1);
+
+    if (gb->cgb && (key1 & KEY1_PREPARE))
+    {
+        // CGB speed switch instead of stopping, the CPU pauses meanwhile
+        gb->double_speed = !gb->double_speed;
+        gb->memory.ram[GB_KEY1 - 0x8000] = (key1 & ~(KEY1_PREPARE | KEY1_DOUBLE)) | (gb->double_speed ? KEY1_DOUBLE : 0);
+        gb->m_cycles += CPU_SPEED_SWITCH_CYCLES;
+        return;
+    }
+
     gb->stopped = true;
 
     gb->m_cycles += 1;
@@ -2549,10 +2562,7 @@ static void cpu_handle_interrupts(struct gb_s *gb)
     uint8_t ir_status = ir_enable & ir_flags;
 
     if (ir_status && gb->halted)
-    {
-        printf("Wake up from HALT (IR: %02X, cycles: %d)\n", ir_status, gb->m_cycles);
         gb->halted = false;
-    }
 
     if (gb->ime)
     {
@@ -2599,6 +2609,37 @@ void cpu_raise_interrupt(struct gb_s *gb, interrupts_t ir)
     mem_write_byte(gb, GB_IF, ir_flags | ir);
 }
 
+/**
+ * @brief Returns how long the CPU can stay in HALT without missing an interrupt
+ *
+ * Interrupts are only raised by scheduled events and the timer, so
+ * HALT is skipped up to whichever comes first, instead of spinning one
+ * m-cycle at a time.
+ *
+ * @param gb pointer to the gameboy state struct
+ * @return uint16_t m-cycles to skip (at least 1)
+ */
+static uint16_t cpu_halt_cycles(struct gb_s *gb)
+{
+    uint64_t target = gb->sched.next;
+    uint64_t overflow = timer_next_overflow(gb);
+
+    if (overflow < target)
+        target = overflow;
+    if (gb->run_until < target)
+        target = gb->run_until;
+
+    uint8_t step = 4 >> gb->double_speed;
+
+    if (target <= gb->clock + step)
+        return 1;
+
+    uint64_t m_cycles = (target - gb->clock + step - 1) / step;
+
+    // Keep the cycle delta of cpu_run() within 16 bits
+    return m_cycles > 0x4000 ? 0x4000 : m_cycles;
+}
+
 /**
  * @brief Run one cpu cycle
  *
@@ -2620,6 +2661,8 @@ void cpu_run(struct gb_s *gb)
         // fetch and execute overlap (except for the first fetch, which we accept)
         uint8_t opcode = mem_read_byte(gb, gb->pc++);
 
+        gb->instructions++;
+
         // IME is only enabled after one additional cycle
         if (gb->ime_enable & !gb->ime)
         {
@@ -2639,10 +2682,16 @@ void cpu_run(struct gb_s *gb)
     }
     else
     {
-        gb->m_cycles++;
+        gb->m_cycles += cpu_halt_cycles(gb);
     }
 
+    // The clock keeps counting at single speed, everything else is timed by it
     uint16_t cycles_passed = gb->m_cycles - current_cycles;
+    gb->clock += cycles_passed * (4 >> gb->double_speed);
     timer_run(gb, cycles_passed);
+
+    if (gb->clock >= gb->sched.next)
+        sched_run(gb);
+
     cpu_handle_interrupts(gb);
 }
@@ -3,5 +3,7 @@
 #include <stdint.h>
 #include "gb.h"
 
+#define CPU_SPEED_SWITCH_CYCLES 2050 // m-cycles the CPU pauses for a CGB speed switch
+
 void cpu_raise_interrupt(struct gb_s *gb, interrupts_t ir);
 void cpu_run(struct gb_s *gb);
\ No newline at end of file
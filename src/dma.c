@@ -0,0 +1,206 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "gb.h"
+#include "dma.h"
+#include "memory.h"
+#include "ppu.h"
+#include "sched.h"
+#include "timer.h"
+
+/*
+ * OAM DMA
+ *
+ * Writing DMA copies 160 bytes from the given page to OAM, one byte per
+ * m-cycle on hardware. The copy is done at once when it starts, and a
+ * scheduler event marks the end of the transfer: until then the CPU
+ * can only use HRAM and the I/O registers, other reads return 0xFF and
+ * writes are dropped, which is what games wait for in their HRAM
+ * routine.
+ *
+ * CGB VRAM DMA copies 16 byte blocks to the selected VRAM bank. General
+ * purpose DMA copies everything right away while the CPU waits, HBlank
+ * DMA a block at the start of each HBlank, as a scheduler event.
+ */
+
+/**
+ * @brief Returns the bytes a DMA transfer reads
+ *
+ * Sources from 0xE000 up read from the work RAM below them, the same
+ * way as on hardware. Blocks never cross a page.
+ *
+ * @param gb gameboy state struct
+ * @param src source address
+ * @return const uint8_t* bytes at the source address
+ */
+static const uint8_t *dma_source(struct gb_s *gb, uint16_t src)
+{
+    if (src >= 0xE000)
+        src -= 0x2000;
+
+    return &gb->memory.page[src >> 12][src & (MEMORY_PAGE_SIZE - 1)];
+}
+
+/**
+ * @brief Write byte to DMA
+ *
+ * Starts an OAM DMA transfer, restarting one still running.
+ *
+ * @param gb gameboy state struct
+ * @param data high byte of the source address
+ */
+void dma_write(struct gb_s *gb, uint8_t data)
+{
+    gb->memory.ram[GB_DMA - 0x8000] = data;
+
+    ppu_oam_dma(gb, dma_source(gb, data << 8));
+
+    gb->dma.oam_active = true;
+    memory_select_read(gb);
+    sched_add(gb, SCHED_DMA_OAM, gb->clock + ((DMA_OAM_START + DMA_OAM_CYCLES) >> gb->double_speed));
+}
+
+/**
+ * @brief Ends an OAM DMA transfer, the CPU can use the whole bus again
+ *
+ * @param gb gameboy state struct
+ * @param when T-cycle timestamp the event was scheduled for
+ */
+void dma_oam_event(struct gb_s *gb, uint64_t when)
+{
+    (void)when;
+
+    gb->dma.oam_active = false;
+    memory_select_read(gb);
+}
+
+/**
+ * @brief Copies the next VRAM DMA block
+ *
+ * @param gb gameboy state struct
+ */
+static void dma_hdma_block(struct gb_s *gb)
+{
+    struct dma_s *dma = &gb->dma;
+    const uint8_t *data = dma_source(gb, dma->hdma_src);
+
+    if (gb->memory.page[0x8] == gb->memory.vram1)
+        // Not drawn, the renderer only knows bank 0
+        memcpy(&gb->memory.vram1[dma->hdma_dst - 0x8000], data, DMA_HDMA_BLOCK);
+    else
+        ppu_vram_dma(gb, dma->hdma_dst, data, DMA_HDMA_BLOCK);
+
+    dma->hdma_src += DMA_HDMA_BLOCK;
+    dma->hdma_dst = 0x8000 | ((dma->hdma_dst + DMA_HDMA_BLOCK) & 0x1FF0);
+    dma->hdma_blocks--;
+
+    // Reads back the blocks left minus one, 0xFF once done
+    gb->memory.ram[GB_HDMA5 - 0x8000] = dma->hdma_blocks - 1;
+}
+
+/**
+ * @brief Schedules the next HBlank DMA block
+ *
+ * @param gb gameboy state struct
+ */
+static void dma_hdma_schedule(struct gb_s *gb)
+{
+    // With the LCD off there are no HBlanks, the transfer is held until it is back on
+    sched_add(gb, SCHED_HDMA, ppu_next_hblank(gb));
+}
+
+/**
+ * @brief Moves a running HBlank DMA transfer to the new HBlanks after an LCDC write
+ *
+ * Turning the LCD off holds the transfer, turning it back on resumes it
+ * at the first HBlank of the restarted frame.
+ *
+ * @param gb gameboy state struct
+ */
+void dma_hdma_lcd_switch(struct gb_s *gb)
+{
+    if (gb->dma.hdma_active)
+        dma_hdma_schedule(gb);
+}
+
+/**
+ * @brief Write byte to HDMA5
+ *
+ * Starts a general purpose or HBlank DMA transfer with the source and
+ * destination from HDMA1-4, or stops a running HBlank transfer.
+ *
+ * @param gb gameboy state struct
+ * @param data transfer mode (bit 7) and number of blocks minus one
+ */
+void dma_hdma_write(struct gb_s *gb, uint8_t data)
+{
+    struct dma_s *dma = &gb->dma;
+    const uint8_t *regs = &gb->memory.ram[GB_HDMA1 - 0x8000];
+
+    if (dma->hdma_active && !(data & 0x80))
+    {
+        // The blocks left stay readable
+        dma->hdma_active = false;
+        gb->memory.ram[GB_HDMA5 - 0x8000] |= 0x80;
+        sched_remove(gb, SCHED_HDMA);
+        return;
+    }
+
+    dma->hdma_src = (regs[0] << 8 | regs[1]) & 0xFFF0;
+    dma->hdma_dst = 0x8000 | ((regs[2] << 8 | regs[3]) & 0x1FF0);
+    dma->hdma_blocks = (data & 0x7F) + 1;
+
+    if (data & 0x80)
+    {
+        dma->hdma_active = true;
+        gb->memory.ram[GB_HDMA5 - 0x8000] = data & 0x7F;
+
+        // Started during HBlank or with the LCD off, the first block is copied right away
+        if ((ppu_read_stat(gb) & STAT_MODE_MASK) == PPU_MODE_HBLANK)
+            dma_hdma_block(gb);
+
+        dma_hdma_schedule(gb);
+        return;
+    }
+
+    // General purpose DMA, the CPU waits until everything is copied
+    uint8_t blocks = dma->hdma_blocks;
+
+    while (dma->hdma_blocks)
+        dma_hdma_block(gb);
+
+    gb->m_cycles += blocks * (DMA_HDMA_BLOCK_CYCLES / 4) << gb->double_speed;
+}
+
+/**
+ * @brief Copies an HBlank DMA block at the start of an HBlank
+ *
+ * The CPU waits while the block is copied, the clock is advanced here
+ * as no instruction is running. Only scheduled while the LCD is on,
+ * see dma_hdma_lcd_switch().
+ *
+ * @param gb gameboy state struct
+ * @param when T-cycle timestamp the event was scheduled for
+ */
+void dma_hdma_event(struct gb_s *gb, uint64_t when)
+{
+    struct dma_s *dma = &gb->dma;
+
+    (void)when;
+
+    if (dma->hdma_active && dma->hdma_blocks && (gb->memory.ram[GB_LCDC - 0x8000] & LCDC_LCD_ENABLE))
+    {
+        dma_hdma_block(gb);
+
+        gb->clock += DMA_HDMA_BLOCK_CYCLES;
+        timer_run(gb, (DMA_HDMA_BLOCK_CYCLES / 4) << gb->double_speed);
+    }
+
+    if (!dma->hdma_blocks)
+    {
+        dma->hdma_active = false;
+        return;
+    }
+
+    dma_hdma_schedule(gb);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define DMA_OAM_LENGTH 160                  // Bytes copied to OAM
+#define DMA_OAM_CYCLES (DMA_OAM_LENGTH * 4) // One byte per m-cycle
+#define DMA_OAM_START 16                    // T-cycles from the start of the LDH writing DMA to the first byte copied
+#define DMA_HDMA_BLOCK 16                   // Bytes copied to VRAM per HBlank
+#define DMA_HDMA_BLOCK_CYCLES 32            // T-cycles the CPU waits per block, in either speed mode
+
+/* OAM and CGB VRAM DMA state, bytes are copied a block at once */
+struct dma_s
+{
+    bool oam_active;  // The CPU only reaches HRAM and the I/O registers
+    bool hdma_active; // HBlank DMA copies a block at the start of each HBlank
+    uint16_t hdma_src;
+    uint16_t hdma_dst;
+    uint8_t hdma_blocks; // Blocks left to copy
+};
+
+struct gb_s;
+
+void dma_write(struct gb_s *gb, uint8_t data);
+void dma_oam_event(struct gb_s *gb, uint64_t when);
+void dma_hdma_write(struct gb_s *gb, uint8_t data);
+void dma_hdma_event(struct gb_s *gb, uint64_t when);
+void dma_hdma_lcd_switch(struct gb_s *gb);
@@ -0,0 +1,51 @@
+#include <stdint.h>
+#include "drc.h"
+
+/*
+ * Dynamic rate control
+ *
+ * The emulation is paced by a host timer, while the audio device
+ * consumes samples at the rate of its own clock. The two never match
+ * exactly, so with a fixed ratio the output buffer slowly runs empty
+ * or grows without bound. Instead, the ratio is nudged by a fraction
+ * of a percent depending on how far the buffer fill is from the
+ * target: above it fewer samples are produced per emulated frame,
+ * below it more. The pitch change is far too small to be heard.
+ * This is the scheme from "Dynamic Rate Control for Retro Game
+ * Emulators" (H. K. Arntzen).
+ */
+
+/**
+ * @brief Sets up rate control between two nominal sample rates
+ *
+ * @param drc rate control state
+ * @param in_rate nominal input rate in Hz
+ * @param out_rate nominal output rate in Hz
+ * @param target buffer fill to regulate to, in output samples
+ */
+void drc_init(struct drc_s *drc, uint32_t in_rate, uint32_t out_rate, uint32_t target)
+{
+    drc->base_ratio = (double)out_rate / in_rate;
+    drc->ratio = drc->base_ratio;
+    drc->target = target ? target : 1;
+}
+
+/**
+ * @brief Adjusts the ratio to the current buffer fill
+ *
+ * @param drc rate control state
+ * @param fill output samples currently buffered
+ * @return double new output samples per input sample
+ */
+double drc_update(struct drc_s *drc, uint32_t fill)
+{
+    double error = ((double)drc->target - fill) / drc->target;
+
+    if (error > 1.0)
+        error = 1.0;
+    else if (error < -1.0)
+        error = -1.0;
+
+    drc->ratio = drc->base_ratio * (1.0 + DRC_MAX_ADJUST * error);
+    return drc->ratio;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+
+#define DRC_MAX_ADJUST 0.005 // Largest relative deviation from the nominal ratio
+
+/* Dynamic rate control */
+struct drc_s
+{
+    double base_ratio; // Nominal output samples per input sample
+    double ratio;      // Current output samples per input sample
+    uint32_t target;   // Buffer fill to regulate to, in output samples
+};
+
+void drc_init(struct drc_s *drc, uint32_t in_rate, uint32_t out_rate, uint32_t target);
+double drc_update(struct drc_s *drc, uint32_t fill);
@@ -1,14 +1,23 @@
 #include <assert.h>
+#include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include "gb.h"
+#include "apu.h"
+#include "cpu.h"
+#include "joypad.h"
 #include "memory.h"
+#include "ppu.h"
+#include "sched.h"
+#include "serial.h"
 
 void gb_init(struct gb_s *gb)
 {
+    memset(gb, 0, sizeof(*gb));
+
     gb->a = 0x01;
     gb->f = 0xB0;
     gb->b = 0x00;
@@ -20,10 +29,78 @@ void gb_init(struct gb_s *gb)
 
     gb->pc = 0x0100;
     gb->sp = 0xFFFE;
+
+    // Post boot ROM LCD state
+    gb->memory.ram[GB_LCDC - 0x8000] = 0x91;
+    gb->memory.ram[GB_BGP - 0x8000] = 0xFC;
+    memory_set_mbc(gb, MBC_NONE);
+    joypad_init(gb);
+    sched_init(gb);
+    serial_init(gb);
+    ppu_init(gb);
+    apu_init(gb);
 }
 
-void gb_run(struct gb_s *gb)
+/**
+ * @brief Runs the emulation until the clock reaches a timestamp
+ *
+ * The last instruction may overshoot the timestamp by a few cycles,
+ * callers running frame after frame should keep their own target
+ * instead of adding to the current clock. Serial output sent in the
+ * meantime has reached its sink on return.
+ *
+ * @param gb gameboy state struct
+ * @param until T-cycle timestamp to run to
+ */
+void gb_run(struct gb_s *gb, uint64_t until)
 {
+    gb->run_until = until;
+
+    // Input for games waiting on the joypad interrupt, others latch it when reading JOYP
+    joypad_latch(gb);
+
+    while (gb->clock < until)
+    {
+        if (gb->stopped)
+        {
+            // Nothing runs until a button press wakes the CPU up again,
+            // events due in the meantime are still dispatched on time
+            while (gb->sched.next < until)
+            {
+                gb->clock = gb->sched.next;
+                sched_run(gb);
+            }
+
+            gb->clock = until;
+            break;
+        }
+
+        cpu_run(gb);
+    }
+
+    serial_flush(gb);
+}
+
+/**
+ * @brief Like gb_run(), but logs the state before every instruction
+ *
+ * @param gb gameboy state struct
+ * @param until T-cycle timestamp to run to
+ * @param log_file instruction log
+ */
+void gb_run_logged(struct gb_s *gb, uint64_t until, FILE *log_file)
+{
+    gb->run_until = until;
+    joypad_latch(gb);
+
+    while (gb->clock < until && !gb->stopped)
+    {
+        gb_log_state(gb, log_file, gb->gbdoc);
+        cpu_run(gb);
+    }
+
+    // Let gb_run() handle STOP
+    gb_run(gb, until);
 }
 
 int gb_load_rom(struct gb_s *gb, const char *path)
@@ -40,19 +117,69 @@ int gb_load_rom(struct gb_s *gb, const char *path)
     long rom_size = ftell(f);
     fseek(f, 0, SEEK_SET);
 
-    if (rom_size > 0x8000)
+    if (rom_size > MEMORY_MAX_ROM)
     {
         printf("ROM too large: %ld.\n", rom_size);
+        fclose(f);
+        return -1;
+    }
+
+    // Rounded up to whole banks, so bank numbers can be masked
+    uint32_t size = 2 * MEMORY_ROM_BANK;
+    while (size < (uint32_t)rom_size)
+        size <<= 1;
+
+    uint8_t *rom = malloc(size);
+    if (!rom)
+    {
+        fclose(f);
         return -1;
     }
 
-    memset(gb->memory.rom, 0xFF, 0x8000); /* Pad with 0xFFs */
-    fread(gb->memory.rom, 1, rom_size, f);
+    memset(rom, 0xFF, size); /* Pad with 0xFFs */
+    fread(rom, 1, rom_size, f);
     fclose(f);
 
+    mbc_type_t mbc = memory_mbc_type(rom[GB_CART_TYPE]);
+    if (mbc == MBC_NONE && rom_size > 2 * MEMORY_ROM_BANK)
+    {
+        printf("Unsupported cartridge type: 0x%02X.\n", rom[GB_CART_TYPE]);
+        free(rom);
+        return -1;
+    }
+
+    gb_unload_rom(gb);
+    gb->memory.rom = rom;
+    gb->memory.rom_size = size;
+    memory_set_mbc(gb, mbc);
+
+    if (gb->memory.rom[GB_CGB_FLAG] & 0x80)
+    {
+        // Post boot ROM CGB state, games check A to detect the CGB
+        gb->cgb = true;
+        gb->a = 0x11;
+        gb->memory.ram[GB_KEY1 - 0x8000] = 0x7E;
+        gb->memory.ram[GB_VBK - 0x8000] = 0xFE;
+        gb->memory.ram[GB_SVBK - 0x8000] = 0xF8;
+        gb->memory.ram[GB_HDMA5 - 0x8000] = 0xFF;
+        memory_map(gb);
+    }
+
     return 0;
 }
 
+/**
+ * @brief Frees the ROM loaded by gb_load_rom()
+ *
+ * @param gb gameboy state struct
+ */
+void gb_unload_rom(struct gb_s *gb)
+{
+    free(gb->memory.rom);
+    gb->memory.rom = NULL;
+    gb->memory.rom_size = 0;
+}
+
 void gb_log_state(struct gb_s *gb, FILE *log_file, bool gbdoc)
 {
     if (gbdoc)
@@ -89,4 +216,163 @@ void gb_log_state(struct gb_s *gb, FILE *log_file, bool gbdoc)
         fprintf(log_file, "%02X ", mem_read_byte(gb, gb->pc + 2));
         fprintf(log_file, "%02X)\n", mem_read_byte(gb, gb->pc + 3));
     }
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Saves the whole emulation state in memory
+ *
+ * The state is a plain copy of the struct, so this is just a memcpy. It
+ * can only be loaded back into the instance it was saved from, as the
+ * renderer keeps pointers into its own memory. Frames have to be
+ * rendered synchronously (no render worker).
+ *
+ * @param gb gameboy state struct
+ * @param snapshot receives the state
+ */
+void gb_save_state(struct gb_s *gb, struct gb_s *snapshot)
+{
+    memcpy(snapshot, gb, sizeof(*gb));
+}
+
+/**
+ * @brief Restores a state saved with gb_save_state()
+ *
+ * Host connections (serial sink and link, input queue, render worker,
+ * cartridge RAM) are kept. The ROM is shared with the snapshot.
+ *
+ * @param gb gameboy state struct
+ * @param snapshot state to restore
+ */
+void gb_load_state(struct gb_s *gb, const struct gb_s *snapshot)
+{
+    struct serial_s serial = gb->serial;
+    struct spsc_s *queue = gb->joypad.queue;
+    struct ppu_worker_s *worker = gb->ppu.worker;
+    uint8_t *cart_ram = gb->memory.cart_ram;
+    struct save_s *save = gb->memory.save;
+
+    memcpy(gb, snapshot, sizeof(*gb));
+
+    gb->serial = serial;
+    gb->joypad.queue = queue;
+    gb->ppu.worker = worker;
+    gb->memory.cart_ram = cart_ram;
+    gb->memory.save = save;
+    memory_map(gb);
+}
+
+static void gb_discard_serial(void *ctx, const uint8_t *data, size_t len)
+{
+    (void)ctx;
+    (void)data;
+    (void)len;
+}
+
+/**
+ * @brief Runs until the end of the current frame
+ *
+ * Frames end at VBlank, or after a frame's worth of cycles with the LCD
+ * off.
+ *
+ * @param gb gameboy state struct
+ * @param until timestamp to stop at even if the frame didn't end
+ * @return true if the frame ended
+ */
+static bool gb_run_to_vblank(struct gb_s *gb, uint64_t until)
+{
+    uint64_t vblank = ppu_next_vblank(gb);
+    uint64_t end = vblank == SCHED_NEVER ? gb->clock + GB_FRAME_CYCLES : vblank;
+
+    gb_run(gb, end < until ? end : until);
+    return gb->clock >= end;
+}
+
+/**
+ * @brief Runs one frame and shows a frame from the future
+ *
+ * Hides the internal input lag of games: the real frame is run without
+ * rendering, then the state is saved, the given number of frames is run
+ * ahead with the current input and the last of them is returned. The
+ * speculative frames are undone afterwards, only the last one is
+ * rendered.
+ *
+ * @param gb gameboy state struct
+ * @param until timestamp the real frame stops at, nothing is run ahead then
+ * @param frames frames to run ahead (at least 1)
+ * @param snapshot scratch state
+ * @param frame receives the shades of the last speculative frame
+ * @return true if a frame was written (not with the LCD off or stopped early)
+ */
+bool gb_run_ahead(struct gb_s *gb, uint64_t until, unsigned frames, struct gb_s *snapshot, uint8_t *frame)
+{
+    gb->ppu.skip_frame = true;
+    bool ended = gb_run_to_vblank(gb, until);
+    gb->ppu.frame_ready = false;
+
+    if (!ended)
+        return false;
+
+    gb_save_state(gb, snapshot);
+
+    // Input is only latched during real frames, it would be lost on restore.
+    // Serial output is sent again when the real frames get there, the
+    // link cable partner must not see speculative transfers, the save
+    // file speculative writes, and sound is not synthesized at all.
+    struct spsc_s *queue = gb->joypad.queue;
+    gb->joypad.queue = NULL;
+    serial_set_sink(gb, gb_discard_serial, NULL);
+    gb->serial.link = NULL;
+    memory_detach_save(gb);
+    apu_set_synth(gb, false);
+
+    for (unsigned i = 1; i <= frames; i++)
+    {
+        gb->ppu.skip_frame = i != frames;
+        gb_run_to_vblank(gb, UINT64_MAX);
+    }
+
+    bool ready = gb->ppu.frame_ready;
+    if (ready)
+        memcpy(frame, gb->ppu.framebuffer, sizeof(gb->ppu.framebuffer));
+
+    gb_load_state(gb, snapshot);
+    gb->joypad.queue = queue;
+    gb->serial = snapshot->serial;
+    gb->memory.cart_ram = snapshot->memory.cart_ram;
+    gb->memory.save = snapshot->memory.save;
+    memory_map(gb);
+
+    return ready;
+}
+
+/**
+ * @brief Prints CPU, interrupt and LCD state plus a hash of the framebuffer
+ *
+ * @param gb gameboy state struct
+ * @param file output file
+ */
+void gb_dump_state(struct gb_s *gb, FILE *file)
+{
+    // Hashes the frame in progress, with or without the render worker
+    ppu_worker_sync(gb);
+
+    const uint8_t *frame = gb->ppu.framebuffer;
+    uint32_t hash = 2166136261u; // FNV-1a
+
+    for (int i = 0; i < GB_LCD_WIDTH * GB_LCD_HEIGHT; i++)
+    {
+        hash = (hash ^ frame[i]) * 16777619u;
+    }
+
+    fprintf(file, "AF: %04X BC: %04X DE: %04X HL: %04X SP: %04X PC: %04X\n",
+            gb->af, gb->bc, gb->de, gb->hl, gb->sp, gb->pc);
+    fprintf(file, "IME: %d HALT: %d STOP: %d IE: %02X IF: %02X\n",
+            gb->ime, gb->halted, gb->stopped, mem_read_byte(gb, GB_IE), mem_read_byte(gb, GB_IF));
+    fprintf(file, "LCDC: %02X STAT: %02X LY: %02X DIV: %02X TIMA: %02X TAC: %02X\n",
+            mem_read_byte(gb, GB_LCDC), mem_read_byte(gb, GB_STAT), mem_read_byte(gb, GB_LY),
+            mem_read_byte(gb, GB_DIV), mem_read_byte(gb, GB_TIMA), mem_read_byte(gb, GB_TAC));
+    fprintf(file, "Clock: %llu T-cycles (%.3f s), %llu instructions\n",
+            (unsigned long long)gb->clock, (double)gb->clock / GB_CLOCK_SPEED_HZ,
+            (unsigned long long)gb->instructions);
+    fprintf(file, "Frame hash: %08X\n", hash);
+}
@@ -3,13 +3,24 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include "apu.h"
+#include "dma.h"
+#include "joypad.h"
 #include "memory.h"
+#include "ppu.h"
+#include "sched.h"
+#include "serial.h"
+#include "timer.h"
 
 /* Constants */
 #define GB_NUM_REG_8_BIT 8
 #define GB_NUM_REG_16_BIT 6
 #define GB_CLOCK_SPEED_HZ 4194304
-#define GB_DIV_CYCLES GB_CLOCK_SPEED_HZ / 16384
+#define GB_DIV_CYCLES (GB_CLOCK_SPEED_HZ / 16384)
+#define GB_FRAME_CYCLES 70224 // T-cycles per frame (~59.73 Hz)
+#define GB_CGB_FLAG 0x0143    // ROM header byte, bit 7 set for games using CGB features
+#define GB_CART_TYPE 0x0147   // ROM header byte, mapper and extra hardware
+#define GB_RAM_SIZE 0x0149    // ROM header byte, size of the cartridge RAM
 
 /* Flags */
 typedef enum __attribute__((packed)) flags
@@ -124,14 +135,61 @@ struct gb_s
         };
     };
     uint16_t m_cycles;
+    uint64_t clock;        // T-cycles since power on
+    uint64_t instructions; // Instructions executed since power on
+    uint64_t run_until;    // Timestamp gb_run() runs to, HALT is never skipped past it
     bool ime;
     bool ime_enable;
     bool halted;
     bool stopped;
+    bool gbdoc;        // gameboy-doctor compatibility, LY always reads 0x90
+    bool cgb;          // Running a CGB game in CGB mode
+    bool double_speed; // CGB double speed mode, a CPU m-cycle takes 2 T-cycles of the clock
+    struct apu_s apu;
+    struct dma_s dma;
+    struct joypad_s joypad;
     struct memory_s memory;
+    struct ppu_s ppu;
+    struct sched_s sched;
+    struct serial_s serial;
+    struct timer_s timer;
 };
 
+/**
+ * @brief Read byte from memory
+ *
+ * Does not advance cycles!
+ *
+ * @param gb gameboy state struct
+ * @param loc 16-bit memory address to read from
+ * @return uint8_t byte at memory address
+ */
+static inline uint8_t mem_read_byte(struct gb_s *gb, uint16_t loc)
+{
+    return gb->memory.read(gb, loc);
+}
+
+/**
+ * @brief Write byte to memory
+ *
+ * Does not advance cycles!
+ *
+ * @param gb gameboy state struct
+ * @param loc 16-bit memory address to write to
+ * @param data byte to write
+ */
+static inline void mem_write_byte(struct gb_s *gb, uint16_t loc, uint8_t data)
+{
+    gb->memory.write(gb, loc, data);
+}
+
 void gb_init(struct gb_s *gb);
-void gb_run(struct gb_s *gb);
+void gb_run(struct gb_s *gb, uint64_t until);
 int gb_load_rom(struct gb_s *gb, const char *path);
-void gb_log_state(struct gb_s *gb, FILE *log_file, bool gbdoc);
\ No newline at end of file
+void gb_unload_rom(struct gb_s *gb);
+void gb_run_logged(struct gb_s *gb, uint64_t until, FILE *log_file);
+bool gb_run_ahead(struct gb_s *gb, uint64_t until, unsigned frames, struct gb_s *snapshot, uint8_t *frame);
+void gb_save_state(struct gb_s *gb, struct gb_s *snapshot);
+void gb_load_state(struct gb_s *gb, const struct gb_s *snapshot);
+void gb_log_state(struct gb_s *gb, FILE *log_file, bool gbdoc);
+void gb_dump_state(struct gb_s *gb, FILE *file);
\ No newline at end of file
@@ -0,0 +1,215 @@
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "apu.h"
+#include "gb.h"
+#include "headless.h"
+#include "link.h"
+#include "serial.h"
+#include "shm_fb.h"
+#include "wav_out.h"
+
+/*
+ * Headless frontend
+ *
+ * Runs the emulation as fast as possible without any video or input,
+ * for CI and batch runs. Stops after a number of frames or cycles, or
+ * once a test ROM reported a result over the serial port. Frames can be
+ * exported to other processes through shared memory, and the sound
+ * captured to a WAV file, still as fast as possible. The serial port
+ * can be connected by link cable to another process or to a second
+ * instance run alongside, whose output goes to stderr.
+ */
+
+/* Watches the serial output for a string */
+struct serial_match_s
+{
+    const char *needle;
+    size_t len;
+    uint64_t sent;      // Bytes sent so far
+    uint8_t *window;    // Last bytes sent, room for twice the needle
+    size_t window_len;
+    bool found;
+};
+
+static void headless_serial_sink(void *ctx, const uint8_t *data, size_t len)
+{
+    struct serial_match_s *match = ctx;
+
+    serial_sink_stdio(NULL, data, len);
+    match->sent += len;
+
+    for (size_t i = 0; match->needle && !match->found && i < len; i++)
+    {
+        if (match->window_len == 2 * match->len)
+        {
+            // Only the bytes a later one can still complete a match with are kept
+            memmove(match->window, &match->window[match->len + 1], match->len - 1);
+            match->window_len = match->len - 1;
+        }
+
+        match->window[match->window_len++] = data[i];
+        match->found = match->window_len >= match->len &&
+                       memcmp(&match->window[match->window_len - match->len], match->needle, match->len) == 0;
+    }
+}
+
+/**
+ * @brief Runs the emulation without a window until one of the limits is reached
+ *
+ * @param gb gameboy state struct
+ * @param opts run limits and output options
+ * @param keep_running cleared (e.g. by a signal handler) to stop early
+ * @return int 0 on success, 1 if the expected serial output never showed up
+ */
+int headless_run(struct gb_s *gb, const struct headless_opts_s *opts, volatile sig_atomic_t *keep_running)
+{
+    struct serial_match_s match = {0};
+
+    if (opts->until_serial && *opts->until_serial)
+    {
+        match.needle = opts->until_serial;
+        match.len = strlen(opts->until_serial);
+        match.window = malloc(2 * match.len);
+        if (!match.window)
+            return EXIT_FAILURE;
+    }
+
+    serial_set_sink(gb, headless_serial_sink, &match);
+
+    // Sound is only synthesized for a capture, otherwise only the registers are emulated
+    static struct wav_out_s wav;
+    static int16_t samples[BLIP_SIZE * 2];
+
+    apu_set_synth(gb, opts->wav != NULL);
+    if (opts->wav && wav_out_open(&wav, opts->wav, APU_DEFAULT_RATE) != 0)
+        return EXIT_FAILURE;
+
+    // Run-ahead frames are only used for the export ring, it mostly runs here to measure its cost
+    struct gb_s *snapshot = NULL;
+    uint8_t frame[GB_LCD_WIDTH * GB_LCD_HEIGHT];
+    struct timespec t0, t1;
+
+    if (opts->run_ahead)
+    {
+        snapshot = malloc(sizeof(*snapshot));
+        if (!snapshot)
+            return EXIT_FAILURE;
+    }
+
+    static struct link_s link;
+    static struct link_pair_s pair;
+    static struct gb_s partner;
+
+    if (opts->link_rom)
+    {
+        gb_init(&partner);
+        if (gb_load_rom(&partner, opts->link_rom) != 0)
+            return EXIT_FAILURE;
+
+        serial_set_sink(&partner, serial_sink_stdio, stderr);
+        apu_set_synth(&partner, false);
+        link_connect(&pair, gb, &partner);
+    }
+    else if (opts->link && link_open(&link, gb, opts->link) != 0)
+        return EXIT_FAILURE;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    uint64_t start = gb->clock;
+    uint64_t end = UINT64_MAX;
+    uint64_t frames = 0;
+
+    if (opts->frames)
+        end = start + opts->frames * GB_FRAME_CYCLES;
+    if (opts->cycles && start + opts->cycles < end)
+        end = start + opts->cycles;
+
+    // Run in frame sized slices so the serial match and signals are noticed
+    while (*keep_running && !match.found && gb->clock < end)
+    {
+        uint64_t until = start + ++frames * GB_FRAME_CYCLES;
+        if (until > end)
+            until = end;
+
+        if (snapshot)
+        {
+            if (gb_run_ahead(gb, until, opts->run_ahead, snapshot, frame) && opts->shm)
+                shm_fb_publish(opts->shm, frame, gb->clock);
+        }
+        else if (opts->log_file)
+            gb_run_logged(gb, until, opts->log_file);
+        else if (opts->link_rom)
+        {
+            link_run_pair(&pair, until);
+            partner.ppu.frame_ready = false;
+        }
+        else if (opts->link)
+            link_run(&link, until);
+        else
+            gb_run(gb, until);
+
+        if (gb->ppu.frame_ready)
+        {
+            if (opts->shm)
+                shm_fb_publish(opts->shm, ppu_framebuffer(gb), gb->clock);
+            gb->ppu.frame_ready = false;
+        }
+
+        if (opts->wav)
+            wav_out_write(&wav, samples, apu_read_samples(gb, samples, BLIP_SIZE));
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (snapshot)
+    {
+        double ms = (t1.tv_sec - t0.tv_sec) * 1000.0 + (t1.tv_nsec - t0.tv_nsec) / 1000000.0;
+        fprintf(stderr, "Run-ahead %u: %.3f ms per frame\n", opts->run_ahead, ms / frames);
+        free(snapshot);
+    }
+
+    if (opts->link_rom)
+    {
+        link_disconnect(&pair);
+        serial_set_sink(&partner, NULL, NULL);
+        gb_unload_rom(&partner);
+    }
+    else if (opts->link)
+        link_close(&link);
+
+    serial_set_sink(gb, NULL, NULL);
+    free(match.window);
+
+    if (match.sent)
+        printf("\n");
+    fflush(stdout);
+
+    if (opts->dump_state)
+        gb_dump_state(gb, stdout);
+
+    if (opts->wav)
+    {
+        bool ok = wav_out_close(&wav) == 0;
+
+        // The hash is the golden value for regression runs
+        printf("Audio %llu samples at %u Hz, hash %016llX\n", (unsigned long long)wav.samples, wav.rate,
+               (unsigned long long)wav.hash);
+        if (atomic_load(&wav.stalls))
+            fprintf(stderr, "WAV writer stalled the emulation %u times\n", (unsigned)atomic_load(&wav.stalls));
+        if (!ok)
+            return EXIT_FAILURE;
+    }
+
+    if (match.needle && !match.found)
+    {
+        fprintf(stderr, "Serial output \"%s\" not seen\n", match.needle);
+        return 1;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "gb.h"
+#include "shm_fb.h"
+
+/* Headless run limits and output */
+struct headless_opts_s
+{
+    uint64_t frames;          // Frames to run, 0 for no limit
+    uint64_t cycles;          // T-cycles to run, 0 for no limit
+    const char *until_serial; // Stop once the serial output contains this string
+    bool dump_state;          // Print the final state
+    unsigned run_ahead;       // Frames to run ahead, 0 to disable
+    FILE *log_file;           // Instruction log, NULL to disable
+    struct shm_fb_s *shm;     // Frame export ring, NULL to disable
+    const char *wav;          // Sound capture file, NULL to disable
+    const char *link;         // Link cable shared memory name, NULL to disable
+    const char *link_rom;     // ROM of a second instance on the link cable, NULL to disable
+};
+
+int headless_run(struct gb_s *gb, const struct headless_opts_s *opts, volatile sig_atomic_t *keep_running);
@@ -0,0 +1,140 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include "gb.h"
+#include "cpu.h"
+#include "joypad.h"
+#include "spsc.h"
+
+/*
+ * Joypad
+ *
+ * Host input arrives through a lock-free queue filled by the frontend
+ * thread. The queue is only drained when the game reads JOYP (or at the
+ * start of a gb_run() slice, for games waiting on the joypad interrupt),
+ * so input is latched as late as possible. The emulated cycle input
+ * last took effect at is kept, so frontends can measure how long it
+ * takes to show up in a frame.
+ */
+
+/**
+ * @brief Returns the lower nibble of JOYP, 0 bits are pressed buttons
+ *
+ * @param joypad joypad state
+ * @return uint8_t input lines (0x0-0xF)
+ */
+static uint8_t joypad_lines(const struct joypad_s *joypad)
+{
+    uint8_t lines = 0x0F;
+
+    if (!(joypad->select & JOYP_SELECT_DPAD))
+        lines &= ~(joypad->pressed & 0x0F);
+    if (!(joypad->select & JOYP_SELECT_BUTTONS))
+        lines &= ~(joypad->pressed >> 4);
+
+    return lines;
+}
+
+/**
+ * @brief Raises the joypad interrupt if an input line went low
+ *
+ * Also ends STOP mode.
+ *
+ * @param gb gameboy state struct
+ * @param old_lines input lines before the change
+ */
+static void joypad_check_interrupt(struct gb_s *gb, uint8_t old_lines)
+{
+    if (!(old_lines & ~joypad_lines(&gb->joypad)))
+        return;
+
+    cpu_raise_interrupt(gb, IR_JOYPAD);
+    gb->stopped = false;
+}
+
+void joypad_init(struct gb_s *gb)
+{
+    gb->joypad.pressed = 0;
+    gb->joypad.select = JOYP_SELECT_DPAD | JOYP_SELECT_BUTTONS;
+    gb->joypad.queue = NULL;
+    gb->joypad.last_input = 0;
+}
+
+/**
+ * @brief Connects the queue host input events are read from
+ *
+ * @param gb gameboy state struct
+ * @param queue queue of struct joypad_event_s, NULL to disconnect
+ */
+void joypad_set_queue(struct gb_s *gb, struct spsc_s *queue)
+{
+    gb->joypad.queue = queue;
+}
+
+/**
+ * @brief Applies all queued host input events at the current cycle
+ *
+ * @param gb gameboy state struct
+ */
+void joypad_latch(struct gb_s *gb)
+{
+    struct joypad_event_s event;
+
+    if (!gb->joypad.queue)
+        return;
+
+    while (spsc_pop(gb->joypad.queue, &event))
+    {
+        gb->joypad.last_input = gb->clock;
+        joypad_set(gb, event.button, event.pressed);
+    }
+}
+
+/**
+ * @brief Presses or releases a button right away
+ *
+ * @param gb gameboy state struct
+ * @param button button to change
+ * @param pressed true to press, false to release
+ */
+void joypad_set(struct gb_s *gb, joypad_button_t button, bool pressed)
+{
+    uint8_t old_lines = joypad_lines(&gb->joypad);
+
+    if (pressed)
+        gb->joypad.pressed |= 1 << button;
+    else
+        gb->joypad.pressed &= ~(1 << button);
+
+    joypad_check_interrupt(gb, old_lines);
+}
+
+/**
+ * @brief Read JOYP
+ *
+ * @param gb gameboy state struct
+ * @return uint8_t JOYP register value
+ */
+uint8_t joypad_read(struct gb_s *gb)
+{
+    joypad_latch(gb);
+
+    return 0xC0 | gb->joypad.select | joypad_lines(&gb->joypad);
+}
+
+/**
+ * @brief Write byte to JOYP
+ *
+ * Only the select bits are writable. Selecting a group with a pressed
+ * button raises the joypad interrupt.
+ *
+ * @param gb gameboy state struct
+ * @param data byte to write
+ */
+void joypad_write(struct gb_s *gb, uint8_t data)
+{
+    uint8_t old_lines = joypad_lines(&gb->joypad);
+
+    gb->joypad.select = data & (JOYP_SELECT_DPAD | JOYP_SELECT_BUTTONS);
+    joypad_check_interrupt(gb, old_lines);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define JOYP_SELECT_DPAD 0x10    // 0 = d-pad readable in the lower nibble
+#define JOYP_SELECT_BUTTONS 0x20 // 0 = buttons readable in the lower nibble
+
+/* Joypad buttons, in JOYP bit order (directions first, then actions) */
+typedef enum joypad_button
+{
+    JOYPAD_RIGHT,
+    JOYPAD_LEFT,
+    JOYPAD_UP,
+    JOYPAD_DOWN,
+    JOYPAD_A,
+    JOYPAD_B,
+    JOYPAD_SELECT,
+    JOYPAD_START,
+    JOYPAD_NUM_BUTTONS
+} joypad_button_t;
+
+/* Host input event */
+struct joypad_event_s
+{
+    uint8_t button; // joypad_button_t
+    bool pressed;
+};
+
+/* Joypad state */
+struct joypad_s
+{
+    uint8_t pressed;      // Pressed buttons, bit per joypad_button_t
+    uint8_t select;       // Select bits written to JOYP
+    struct spsc_s *queue; // Host events (struct joypad_event_s), NULL if unused
+    uint64_t last_input;  // T-cycle timestamp the last host event took effect at, for latency reports
+};
+
+struct gb_s;
+struct spsc_s;
+
+void joypad_init(struct gb_s *gb);
+void joypad_set_queue(struct gb_s *gb, struct spsc_s *queue);
+void joypad_latch(struct gb_s *gb);
+void joypad_set(struct gb_s *gb, joypad_button_t button, bool pressed);
+uint8_t joypad_read(struct gb_s *gb);
+void joypad_write(struct gb_s *gb, uint8_t data);
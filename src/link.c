@@ -0,0 +1,465 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "gb.h"
+#include "link.h"
+#include "sched.h"
+#include "serial.h"
+
+/*
+ * Link cable
+ *
+ * Connects the serial ports of two instances, in the same process or
+ * in two processes through a shared memory mailbox. The instances run
+ * on their own and only look at each other at transfer boundaries:
+ *
+ * A transfer completes 8 bit times after the master started it, so
+ * nothing a side does can reach the other one earlier than that. Each
+ * side publishes how far it has run, and the other may always run up
+ * to a transfer time past that (less an instruction, as a run may end
+ * past its bound) without missing anything. A master posts the
+ * completion time and its byte when it starts a transfer; the other
+ * side picks that up before it gets there and schedules the
+ * exchange at exactly that time, answering with its own byte. The
+ * master takes the answer at its completion, waiting for the other
+ * side to get there if necessary (in the same process it simply runs
+ * the other instance up to it).
+ *
+ * Both sides only wait on each other when one runs more than a
+ * transfer time ahead, so the pair runs at about the speed of two
+ * independent instances.
+ */
+
+#define LINK_MAX_STEP 24 // T-cycles of the longest instruction, gb_run() overshoots its bound by less
+// Transfers are twice as fast in CGB double speed mode, a side stopping at the bound stays short of one
+#define LINK_LOOKAHEAD (8 * SERIAL_BIT_CYCLES / 2 - LINK_MAX_STEP)
+#define LINK_POLL_NS 20000
+
+/**
+ * @brief Sets up one end of a cable and plugs it into an instance
+ *
+ * @param link end of the cable
+ * @param shared mailbox
+ * @param index side of the mailbox
+ * @param gb instance at this end
+ */
+static void link_attach(struct link_s *link, struct link_shared_s *shared, int index, struct gb_s *gb)
+{
+    link->shared = shared;
+    link->local = &shared->side[index];
+    link->remote = &shared->side[!index];
+    link->gb = gb;
+    link->seen = 0; // Transfers the other side started before this one joined are still due
+
+    atomic_store_explicit(&link->local->clock, gb->clock, memory_order_release);
+    gb->serial.link = link;
+}
+
+/**
+ * @brief Returns how far this end may run without missing a transfer
+ *
+ * Has to be called before link_poll(), so every transfer started
+ * before the clock read here is seen there.
+ *
+ * @param link end of the cable
+ * @param until timestamp the caller wants to reach
+ * @return uint64_t T-cycle timestamp to run to
+ */
+static uint64_t link_bound(struct link_s *link, uint64_t until)
+{
+    uint64_t clock = atomic_load_explicit(&link->remote->clock, memory_order_acquire);
+
+    if (link->gone || clock == LINK_DETACHED || clock + LINK_LOOKAHEAD >= until)
+        return until;
+
+    return clock + LINK_LOOKAHEAD;
+}
+
+/**
+ * @brief Schedules a transfer the other side started
+ *
+ * @param link end of the cable
+ */
+static void link_poll(struct link_s *link)
+{
+    uint32_t seq = atomic_load_explicit(&link->remote->seq, memory_order_acquire);
+
+    if (seq == link->seen)
+        return;
+
+    uint64_t when = link->remote->when;
+
+    link->seen = seq;
+    link->incoming = link->remote->data;
+    sched_add(link->gb, SCHED_LINK, when > link->gb->clock ? when : link->gb->clock);
+}
+
+/**
+ * @brief Runs this end as far as the other side allows
+ *
+ * @param link end of the cable
+ * @param until timestamp to stop at
+ */
+static void link_step(struct link_s *link, uint64_t until)
+{
+    uint64_t bound = link_bound(link, until);
+
+    link_poll(link);
+
+    if (bound <= link->gb->clock)
+        return;
+
+    link->running = true;
+    gb_run(link->gb, bound);
+    link->running = false;
+
+    atomic_store_explicit(&link->local->clock, link->gb->clock, memory_order_release);
+}
+
+/**
+ * @brief Waits a little for the other side, giving up on it once it stopped moving
+ *
+ * @param link end of the cable
+ * @param last remote clock seen by the previous call
+ * @param idle_ns time the remote clock stood still so far
+ */
+static void link_wait(struct link_s *link, uint64_t *last, uint64_t *idle_ns)
+{
+    uint64_t clock = atomic_load_explicit(&link->remote->clock, memory_order_acquire);
+
+    if (clock != *last)
+    {
+        *last = clock;
+        *idle_ns = 0;
+    }
+    else if (*idle_ns >= LINK_TIMEOUT_MS * 1000000ull)
+    {
+        printf("Link partner stopped responding, continuing without it\n");
+        link->gone = true;
+        return;
+    }
+
+    nanosleep(&(struct timespec){.tv_nsec = LINK_POLL_NS}, NULL);
+    *idle_ns += LINK_POLL_NS;
+}
+
+/**
+ * @brief Connects two instances in the same process
+ *
+ * @param pair cable state, must stay in place while connected
+ * @param a first instance
+ * @param b second instance
+ */
+void link_connect(struct link_pair_s *pair, struct gb_s *a, struct gb_s *b)
+{
+    memset(pair, 0, sizeof(*pair));
+    pair->shared.magic = LINK_MAGIC;
+    pair->shared.version = LINK_VERSION;
+    atomic_init(&pair->shared.attached, 2);
+
+    link_attach(&pair->end[0], &pair->shared, 0, a);
+    link_attach(&pair->end[1], &pair->shared, 1, b);
+    pair->end[0].peer = &pair->end[1];
+    pair->end[1].peer = &pair->end[0];
+}
+
+/**
+ * @brief Runs both instances until their clocks reach a timestamp
+ *
+ * Always runs the instance that is behind, as far as the other allows.
+ *
+ * @param pair connected instances
+ * @param until T-cycle timestamp to run to
+ */
+void link_run_pair(struct link_pair_s *pair, uint64_t until)
+{
+    struct link_s *a = &pair->end[0];
+    struct link_s *b = &pair->end[1];
+
+    while (a->gb->clock < until || b->gb->clock < until)
+    {
+        bool first = b->gb->clock >= until || (a->gb->clock < until && a->gb->clock <= b->gb->clock);
+
+        link_step(first ? a : b, until);
+    }
+}
+
+void link_disconnect(struct link_pair_s *pair)
+{
+    pair->end[0].gb->serial.link = NULL;
+    pair->end[1].gb->serial.link = NULL;
+}
+
+/**
+ * @brief Builds the shared memory object name
+ *
+ * @param link end of the cable
+ * @param name name given by the user, a leading slash is added if missing
+ * @return int 0 on success
+ */
+static int link_set_name(struct link_s *link, const char *name)
+{
+    int len = snprintf(link->name, sizeof(link->name), "%s%s", name[0] == '/' ? "" : "/", name);
+
+    if (len < 2 || len >= (int)sizeof(link->name) || strchr(link->name + 1, '/'))
+    {
+        printf("Invalid shared memory name '%s'\n", name);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Maps the mailbox, creating it if this is the first side
+ *
+ * @param link end of the cable
+ * @return int side of the mailbox on success, -1 on failure
+ */
+static int link_map(struct link_s *link)
+{
+    bool create = true;
+    int fd = shm_open(link->name, O_CREAT | O_EXCL | O_RDWR, 0600);
+
+    if (fd < 0 && errno == EEXIST)
+    {
+        create = false;
+        fd = shm_open(link->name, O_RDWR, 0);
+    }
+
+    if (fd < 0)
+    {
+        printf("Could not open shared memory %s: %s\n", link->name, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (create ? ftruncate(fd, sizeof(struct link_shared_s)) != 0
+               : fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct link_shared_s))
+    {
+        printf("Shared memory %s is not a link mailbox\n", link->name);
+        close(fd);
+        return -1;
+    }
+
+    link->shared = mmap(NULL, sizeof(struct link_shared_s), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (link->shared == MAP_FAILED)
+    {
+        printf("Could not map shared memory %s: %s\n", link->name, strerror(errno));
+        link->shared = NULL;
+        return -1;
+    }
+
+    struct link_shared_s *shared = link->shared;
+
+    if (create)
+    {
+        // Fresh objects are zero filled, both sides start at clock 0
+        shared->version = LINK_VERSION;
+        shared->creator_pid = getpid();
+        atomic_init(&shared->attached, 1);
+
+        // The other side checks the magic last
+        atomic_thread_fence(memory_order_release);
+        shared->magic = LINK_MAGIC;
+
+        link->owner = true;
+        return 0;
+    }
+
+    // The creator may still be setting it up
+    for (int i = 0; i < 1000 && shared->magic != LINK_MAGIC; i++)
+        nanosleep(&(struct timespec){.tv_nsec = 1000000}, NULL);
+    atomic_thread_fence(memory_order_acquire);
+
+    if (shared->magic != LINK_MAGIC || shared->version != LINK_VERSION)
+    {
+        printf("Shared memory %s is not a compatible link mailbox\n", link->name);
+        munmap(link->shared, sizeof(struct link_shared_s));
+        link->shared = NULL;
+        return -1;
+    }
+
+    if (kill(shared->creator_pid, 0) != 0 && errno == ESRCH)
+    {
+        // Left over from a run that didn't close it
+        munmap(link->shared, sizeof(struct link_shared_s));
+        link->shared = NULL;
+        shm_unlink(link->name);
+        return link_map(link);
+    }
+
+    // A rejected third side must not be counted
+    unsigned attached = atomic_load(&shared->attached);
+    do
+    {
+        if (attached >= 2)
+        {
+            printf("Link %s already has two sides\n", link->name);
+            munmap(link->shared, sizeof(struct link_shared_s));
+            link->shared = NULL;
+            return -1;
+        }
+    } while (!atomic_compare_exchange_weak(&shared->attached, &attached, attached + 1));
+
+    return 1;
+}
+
+/**
+ * @brief Plugs an instance into a cable shared with another process
+ *
+ * The first process to open a name creates the mailbox, the second one
+ * joins it. The other side has LINK_TIMEOUT_MS to show up.
+ *
+ * @param link end of the cable, must stay in place while connected
+ * @param gb instance at this end
+ * @param name shared memory object name
+ * @return int 0 on success
+ */
+int link_open(struct link_s *link, struct gb_s *gb, const char *name)
+{
+    memset(link, 0, sizeof(*link));
+
+    if (link_set_name(link, name) != 0)
+        return -1;
+
+    int index = link_map(link);
+    if (index < 0)
+    {
+        link_close(link);
+        return -1;
+    }
+
+    link_attach(link, link->shared, index, gb);
+    return 0;
+}
+
+/**
+ * @brief Runs the instance of a cross-process cable until its clock reaches a timestamp
+ *
+ * @param link end of the cable
+ * @param until T-cycle timestamp to run to
+ */
+void link_run(struct link_s *link, uint64_t until)
+{
+    uint64_t last = LINK_DETACHED;
+    uint64_t idle_ns = 0;
+
+    while (link->gb->clock < until)
+    {
+        uint64_t clock = link->gb->clock;
+
+        link_step(link, until);
+        if (link->gb->clock == clock)
+            link_wait(link, &last, &idle_ns);
+    }
+}
+
+void link_close(struct link_s *link)
+{
+    if (link->gb && link->gb->serial.link == link)
+        link->gb->serial.link = NULL;
+
+    if (!link->shared)
+        return;
+
+    if (link->local)
+        atomic_store_explicit(&link->local->clock, LINK_DETACHED, memory_order_release);
+
+    munmap(link->shared, sizeof(struct link_shared_s));
+    link->shared = NULL;
+
+    if (link->owner)
+        shm_unlink(link->name);
+}
+
+/**
+ * @brief Posts a transfer started with the internal clock
+ *
+ * @param link end of the cable
+ * @param data byte shifted out
+ * @param when T-cycle timestamp the transfer completes at
+ */
+void link_start(struct link_s *link, uint8_t data, uint64_t when)
+{
+    struct link_side_s *local = link->local;
+
+    local->when = when;
+    local->data = data;
+    atomic_store_explicit(&local->seq, atomic_load_explicit(&local->seq, memory_order_relaxed) + 1,
+                          memory_order_release);
+}
+
+/**
+ * @brief Answers a transfer of the other side when it completes
+ *
+ * @param link end of the cable
+ * @param data byte shifted out in return
+ * @return uint8_t byte shifted in
+ */
+uint8_t link_answer(struct link_s *link, uint8_t data)
+{
+    link->local->reply = data;
+    atomic_store_explicit(&link->local->reply_seq, link->seen, memory_order_release);
+
+    return link->incoming;
+}
+
+/**
+ * @brief Takes the answer to a transfer started here
+ *
+ * @param link end of the cable
+ * @param when T-cycle timestamp the transfer completes at
+ * @return uint8_t byte shifted in, all ones without a partner
+ */
+uint8_t link_finish(struct link_s *link, uint64_t when)
+{
+    uint32_t seq = atomic_load_explicit(&link->local->seq, memory_order_relaxed);
+    uint64_t last = LINK_DETACHED;
+    uint64_t idle_ns = 0;
+
+    // The other side may now run up to the transfer
+    atomic_store_explicit(&link->local->clock, link->gb->clock, memory_order_release);
+
+    while (atomic_load_explicit(&link->remote->reply_seq, memory_order_acquire) != seq)
+    {
+        if (link->gone || atomic_load_explicit(&link->remote->clock, memory_order_acquire) == LINK_DETACHED)
+            return 0xFF;
+
+        if (link->peer)
+        {
+            // Same process, nothing runs the other instance unless it's done here
+            struct link_s *peer = link->peer;
+
+            if (peer->running)
+                return 0xFF;
+
+            if (peer->gb->clock < when)
+                link_step(peer, when);
+            else
+            {
+                // Got there before the transfer was posted (e.g. stalled by a GDMA), answer late
+                link_poll(peer);
+                sched_run(peer->gb);
+
+                if (atomic_load_explicit(&link->remote->reply_seq, memory_order_acquire) != seq)
+                    return 0xFF;
+            }
+        }
+        else
+            link_wait(link, &last, &idle_ns);
+    }
+
+    return link->remote->reply;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define LINK_MAGIC 0x4B4E494C // "LINK"
+#define LINK_VERSION 1
+#define LINK_DETACHED UINT64_MAX // Clock of a side that left, it never holds the other one back
+#define LINK_TIMEOUT_MS 5000     // A side that makes no progress for this long is considered gone
+
+/* One side of a cable, only written by the instance at that side */
+struct link_side_s
+{
+    atomic_uint_least64_t clock;     // T-cycles run so far, the other side may run a transfer time past it
+    atomic_uint_least32_t seq;       // Transfers started with the internal clock
+    uint64_t when;                   // Completion timestamp of the last one
+    uint8_t data;                    // Byte it shifts out
+    atomic_uint_least32_t reply_seq; // Last transfer of the other side answered
+    uint8_t reply;                   // Byte shifted back to it
+};
+
+/* Mailbox shared by both sides, in memory or shared memory */
+struct link_shared_s
+{
+    uint32_t magic;
+    uint32_t version;
+    int32_t creator_pid;
+    atomic_uint attached; // Sides that joined
+    struct link_side_s side[2];
+};
+
+/* One end of a cable */
+struct link_s
+{
+    struct link_shared_s *shared;
+    struct link_side_s *local;
+    struct link_side_s *remote;
+    struct gb_s *gb;     // Instance at this end
+    struct link_s *peer; // Other end if it is in the same process, else NULL
+    bool running;        // The instance is inside gb_run()
+    bool gone;           // The other side stopped responding
+    uint32_t seen;       // Last transfer of the other side scheduled here
+    uint8_t incoming;    // Byte it shifts out
+    char name[64];       // Shared memory object name, empty in the same process
+    bool owner;          // Created the shared memory object, unlinks it on close
+};
+
+/* Two instances connected in the same process */
+struct link_pair_s
+{
+    struct link_shared_s shared;
+    struct link_s end[2];
+};
+
+struct gb_s;
+
+// In the same process
+void link_connect(struct link_pair_s *pair, struct gb_s *a, struct gb_s *b);
+void link_run_pair(struct link_pair_s *pair, uint64_t until);
+void link_disconnect(struct link_pair_s *pair);
+
+// Across processes
+int link_open(struct link_s *link, struct gb_s *gb, const char *name);
+void link_run(struct link_s *link, uint64_t until);
+void link_close(struct link_s *link);
+
+// Serial port side
+void link_start(struct link_s *link, uint8_t data, uint64_t when);
+uint8_t link_answer(struct link_s *link, uint8_t data);
+uint8_t link_finish(struct link_s *link, uint64_t when);
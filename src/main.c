@@ -1,10 +1,15 @@
 #include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include "SDL.h"
+#include <string.h>
 #include "gb.h"
-#include "cpu.h"
-#include "memory.h"
+#include "headless.h"
+#include "ppu.h"
+#include "save.h"
+#include "shm_fb.h"
+#ifdef NYAN_SDL
+#include "window.h"
+#endif
 
 static volatile sig_atomic_t keep_running = 1;
 
@@ -14,70 +19,208 @@ static void sig_handler(int _)
     keep_running = 0;
 }
 
+static void usage(const char *name)
+{
+    printf("Usage: %s [options] <rom>\n", name);
+    printf("  --doctor             gameboy-doctor compatible LY reads and instruction log\n");
+    printf("  --log                write an instruction log to nyanGB.instr.log\n");
+    printf("  --render-thread      render frames on a worker thread\n");
+    printf("  --renderer NAME      line renderer, scanline or fifo (needs NYAN_PPU_FIFO)\n");
+    printf("  --run-ahead N        show frames N frames ahead to hide input lag\n");
+    printf("  --shm NAME           export frames to other processes through shared memory\n");
+#ifdef NYAN_SDL
+    printf("  --vsync              pace frames with the display\n");
+    printf("  --speed N            run at N times the native speed, 0 for uncapped\n");
+    printf("  --frameskip N        render only every N+1th frame while uncapped\n");
+    printf("  --post LIST          post-processing chain, e.g. ghost,scale3x (F1-F4 toggle)\n");
+    printf("  --audio-latency MS   target audio latency, 0 to disable audio (default 40)\n");
+    printf("  --headless           run without a window\n");
+#endif
+    printf("  --frames N           stop after N frames (headless)\n");
+    printf("  --cycles N           stop after N T-cycles (headless)\n");
+    printf("  --until-serial STR   stop once STR was sent over the serial port (headless)\n");
+    printf("  --dump-state         print the final state (headless)\n");
+    printf("  --wav FILE           write the sound to FILE and print its hash (headless)\n");
+    printf("  --link NAME          link cable to another process using the same NAME (headless)\n");
+    printf("  --link-rom ROM       link cable to a second instance running ROM (headless)\n");
+}
+
 int main(int argc, char **argv)
 {
-    if (argc != 2)
+    bool gbdoc = false;
+    bool log = false;
+    bool render_thread = false;
+    int renderer = -1; // Build default
+    bool headless = false;
+    unsigned run_ahead = 0;
+    const char *shm_name = NULL;
+    struct headless_opts_s headless_opts = {0};
+#ifdef NYAN_SDL
+    struct window_opts_s window_opts = {.speed = 1, .audio_latency = 40};
+#else
+    // Nothing else is available
+    headless = true;
+#endif
+    int arg;
+
+    for (arg = 1; arg < argc - 1; arg++)
+    {
+        if (strcmp(argv[arg], "--doctor") == 0)
+        {
+            // gameboy-doctor compatible LY reads and log format
+            gbdoc = true;
+            log = true;
+        }
+        else if (strcmp(argv[arg], "--log") == 0)
+            log = true;
+        else if (strcmp(argv[arg], "--render-thread") == 0)
+            render_thread = true;
+        else if (strcmp(argv[arg], "--renderer") == 0 && arg + 2 < argc)
+        {
+            arg++;
+            if (strcmp(argv[arg], "scanline") == 0)
+                renderer = PPU_RENDERER_SCANLINE;
+            else if (strcmp(argv[arg], "fifo") == 0)
+                renderer = PPU_RENDERER_FIFO;
+            else
+            {
+                printf("Unknown renderer %s\n", argv[arg]);
+                return EXIT_FAILURE;
+            }
+        }
+#ifdef NYAN_SDL
+        else if (strcmp(argv[arg], "--vsync") == 0)
+            window_opts.vsync = true;
+        else if (strcmp(argv[arg], "--speed") == 0 && arg + 2 < argc)
+            window_opts.speed = strtoul(argv[++arg], NULL, 0);
+        else if (strcmp(argv[arg], "--frameskip") == 0 && arg + 2 < argc)
+            window_opts.frameskip = strtoul(argv[++arg], NULL, 0);
+        else if (strcmp(argv[arg], "--post") == 0 && arg + 2 < argc)
+        {
+            if (post_parse_chain(&window_opts.post, argv[++arg]) != 0)
+                return EXIT_FAILURE;
+        }
+        else if (strcmp(argv[arg], "--audio-latency") == 0 && arg + 2 < argc)
+            window_opts.audio_latency = strtoul(argv[++arg], NULL, 0);
+#endif
+        else if (strcmp(argv[arg], "--run-ahead") == 0 && arg + 2 < argc)
+            run_ahead = strtoul(argv[++arg], NULL, 0);
+        else if (strcmp(argv[arg], "--shm") == 0 && arg + 2 < argc)
+            shm_name = argv[++arg];
+        else if (strcmp(argv[arg], "--headless") == 0)
+            headless = true;
+        else if (strcmp(argv[arg], "--dump-state") == 0)
+        {
+            headless_opts.dump_state = true;
+            headless = true;
+        }
+        else if (strcmp(argv[arg], "--frames") == 0 && arg + 2 < argc)
+        {
+            headless_opts.frames = strtoull(argv[++arg], NULL, 0);
+            headless = true;
+        }
+        else if (strcmp(argv[arg], "--cycles") == 0 && arg + 2 < argc)
+        {
+            headless_opts.cycles = strtoull(argv[++arg], NULL, 0);
+            headless = true;
+        }
+        else if (strcmp(argv[arg], "--until-serial") == 0 && arg + 2 < argc)
+        {
+            headless_opts.until_serial = argv[++arg];
+            headless = true;
+        }
+        else if (strcmp(argv[arg], "--wav") == 0 && arg + 2 < argc)
+        {
+            headless_opts.wav = argv[++arg];
+            headless = true;
+        }
+        else if (strcmp(argv[arg], "--link") == 0 && arg + 2 < argc)
+        {
+            headless_opts.link = argv[++arg];
+            headless = true;
+        }
+        else if (strcmp(argv[arg], "--link-rom") == 0 && arg + 2 < argc)
+        {
+            headless_opts.link_rom = argv[++arg];
+            headless = true;
+        }
+        else
+            break;
+    }
+
+    if (arg != argc - 1)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (run_ahead && (render_thread || log))
     {
-        printf("Wrong number of arguments %d", argc);
+        // Snapshots need synchronous rendering, and speculative frames would end up in the log
+        printf("--run-ahead can't be combined with --render-thread, --log or --doctor\n");
         return EXIT_FAILURE;
     }
 
-    struct gb_s gb;
-    char *rom_path = argv[1];
+    if ((headless_opts.link || headless_opts.link_rom) && (run_ahead || log))
+    {
+        // The partner would see speculative frames, and the log only covers plain runs
+        printf("--link and --link-rom can't be combined with --run-ahead, --log or --doctor\n");
+        return EXIT_FAILURE;
+    }
+
+    static struct gb_s gb;
+    char *rom_path = argv[arg];
 
     gb_init(&gb);
+    gb.gbdoc = gbdoc;
     if (gb_load_rom(&gb, rom_path) != 0)
         return EXIT_FAILURE;
 
-    FILE *log_file = fopen("nyanGB.instr.log", "w");
-
-    signal(SIGINT, sig_handler);
+    static struct save_s save;
+    if (save_open(&save, &gb, rom_path) != 0)
+        return EXIT_FAILURE;
 
-    SDL_Window *window;
-    SDL_Renderer *renderer;
-    SDL_Surface *surface;
-    SDL_Event event;
+    if (renderer >= 0 && ppu_set_renderer(&gb, renderer) != 0)
+        return EXIT_FAILURE;
 
-    if (SDL_Init(SDL_INIT_VIDEO) < 0)
-    {
-        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't initialize SDL: %s", SDL_GetError());
-        return 3;
-    }
+    if (render_thread && ppu_worker_start(&gb) != 0)
+        return EXIT_FAILURE;
 
-    if (SDL_CreateWindowAndRenderer(320, 240, SDL_WINDOW_RESIZABLE, &window, &renderer))
-    {
-        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't create window and renderer: %s", SDL_GetError());
-        return 3;
-    }
+    FILE *log_file = NULL;
+    if (log)
+        log_file = fopen("nyanGB.instr.log", "w");
 
-    while (keep_running)
-    {
-        SDL_PollEvent(&event);
-        if (event.type == SDL_QUIT)
-        {
-            keep_running = false;
-        }
+    static struct shm_fb_s shm;
+    if (shm_name && shm_fb_create(&shm, shm_name, GB_LCD_WIDTH, GB_LCD_HEIGHT, SHM_FB_SLOTS) != 0)
+        return EXIT_FAILURE;
 
-        gb_log_state(&gb, log_file, false);
-        cpu_run(&gb);
+    signal(SIGINT, sig_handler);
 
-        if (mem_read_byte(&gb, 0xFF02) == 0x81)
-        {
-            printf("%c", mem_read_byte(&gb, 0xFF01));
-            mem_write_byte(&gb, 0xFF02, 0x00);
-        }
+    int ret = EXIT_FAILURE;
 
-        // SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0x00);
-        // SDL_RenderClear(renderer);
-        // SDL_RenderPresent(renderer);
+    if (headless)
+    {
+        headless_opts.log_file = log_file;
+        headless_opts.run_ahead = run_ahead;
+        headless_opts.shm = shm_name ? &shm : NULL;
+        ret = headless_run(&gb, &headless_opts, &keep_running);
     }
+#ifdef NYAN_SDL
+    else
+    {
+        window_opts.log_file = log_file;
+        window_opts.run_ahead = run_ahead;
+        window_opts.shm = shm_name ? &shm : NULL;
+        ret = window_run(&gb, &window_opts, &keep_running);
+    }
+#endif
 
-    fclose(log_file);
-
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
-
-    SDL_Quit();
+    if (log_file)
+        fclose(log_file);
+    shm_fb_close(&shm);
+    ppu_worker_stop(&gb);
+    save_close(&save);
+    gb_unload_rom(&gb);
 
-    return EXIT_SUCCESS;
-}
\ No newline at end of file
+    return ret;
+}
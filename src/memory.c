@@ -1,8 +1,219 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include "gb.h"
+#include "apu.h"
+#include "dma.h"
+#include "joypad.h"
 #include "memory.h"
+#include "ppu.h"
+#include "save.h"
+#include "serial.h"
+
+/*
+ * Memory bus
+ *
+ * Everything below 0xE000 is mapped by a table of 4 KiB page pointers,
+ * so switching ROM and cartridge RAM banks and the CGB VRAM (VBK) and
+ * WRAM (SVBK) banks only updates a pointer. VRAM bank 0 and WRAM banks 0
+ * and 1 live in the flat RAM array the rest of the emulator (and the
+ * DMG) sees, the other banks next to it. The renderer only knows VRAM
+ * bank 0, writes to bank 1 go straight to memory. Cartridge RAM is
+ * mapped from the save file when one is plugged in.
+ *
+ * The read and write paths are instantiated once per memory bank
+ * controller from the same inline bodies, with the controller type a
+ * constant, and the cartridge's pair is installed when the ROM is
+ * loaded. Checks for other controllers fold away: cartridges without
+ * one read ROM straight from the array and never look at bank state.
+ */
+
+// Disabled or missing cartridge RAM, writes to it are dropped
+static uint8_t memory_open_bus[MEMORY_PAGE_SIZE] = {[0 ... MEMORY_PAGE_SIZE - 1] = 0xFF};
+
+/**
+ * @brief Points the page table at the selected banks
+ *
+ * Called on bank switches and whenever the table may be stale, e.g.
+ * after loading a state.
+ *
+ * @param gb gameboy state struct
+ */
+void memory_map(struct gb_s *gb)
+{
+    struct memory_s *memory = &gb->memory;
+    const struct mbc_s *mbc = &memory->mbc;
+    uint8_t vram_bank = 0;
+    uint8_t wram_bank = 1;
+    uint32_t rom_bank0 = 0;
+    uint32_t rom_bank = 1;
+    uint32_t ram_bank = 0;
+    bool ram_enable = true;
+
+    if (gb->cgb)
+    {
+        vram_bank = memory->ram[GB_VBK - 0x8000] & 0x01;
+        // Bank 0 can't be selected, it maps bank 1 instead
+        wram_bank = memory->ram[GB_SVBK - 0x8000] & 0x07;
+        wram_bank = wram_bank ? wram_bank : 1;
+    }
+
+    switch (mbc->type)
+    {
+    case MBC_1:
+        // The bank 0 check only looks at the lower register
+        rom_bank = (mbc->rom_bank ? mbc->rom_bank : 1) | mbc->ram_bank << 5;
+        if (mbc->mode)
+        {
+            rom_bank0 = mbc->ram_bank << 5;
+            ram_bank = mbc->ram_bank;
+        }
+        ram_enable = mbc->ram_enable;
+        break;
+
+    case MBC_3:
+        // RTC registers are not emulated, they read like disabled RAM
+        rom_bank = mbc->rom_bank ? mbc->rom_bank : 1;
+        ram_bank = mbc->ram_bank;
+        ram_enable = mbc->ram_enable && mbc->ram_bank < 0x08;
+        break;
+
+    case MBC_5:
+        rom_bank = mbc->rom_bank;
+        ram_bank = mbc->ram_bank;
+        ram_enable = mbc->ram_enable;
+        break;
+
+    default:
+        break;
+    }
+
+    if (memory->rom)
+    {
+        // Bank numbers wrap around at the ROM size
+        uint8_t *bank0 = &memory->rom[(rom_bank0 * MEMORY_ROM_BANK) & (memory->rom_size - 1)];
+        uint8_t *bank = &memory->rom[(rom_bank * MEMORY_ROM_BANK) & (memory->rom_size - 1)];
+
+        for (int page = 0; page < 4; page++)
+        {
+            memory->page[page] = bank0 + page * MEMORY_PAGE_SIZE;
+            memory->page[page + 4] = bank + page * MEMORY_PAGE_SIZE;
+        }
+    }
+
+    uint8_t *cart_ram = &memory->ram[0x2000];
+    if (!ram_enable)
+        cart_ram = memory_open_bus;
+    else if (memory->cart_ram)
+        cart_ram = &memory->cart_ram[(ram_bank * MEMORY_RAM_BANK) & (memory->cart_ram_size - 1)];
+
+    uint8_t *vram = vram_bank ? memory->vram1 : &memory->ram[0x0000];
+    memory->page[0x8] = vram;
+    memory->page[0x9] = vram + MEMORY_PAGE_SIZE;
+    memory->page[0xA] = cart_ram;
+    memory->page[0xB] = ram_enable ? cart_ram + MEMORY_PAGE_SIZE : memory_open_bus;
+    memory->page[0xC] = &memory->ram[0x4000];
+    memory->page[0xD] = wram_bank > 1 ? memory->wram[wram_bank - 2] : &memory->ram[0x5000];
+}
+
+/**
+ * @brief Gives speculative runs a private copy of the cartridge RAM
+ *
+ * Their writes must never reach the save file. Undone by restoring
+ * cart_ram and save from before.
+ *
+ * @param gb gameboy state struct
+ */
+void memory_detach_save(struct gb_s *gb)
+{
+    struct save_s *save = gb->memory.save;
+
+    if (!save)
+        return;
+
+    memcpy(save->scratch, save->data, save->size);
+    gb->memory.cart_ram = save->scratch;
+    gb->memory.save = NULL;
+    memory_map(gb);
+}
+
+/**
+ * @brief Write byte to a CGB banking or speed register
+ *
+ * Unused bits read back as ones.
+ *
+ * @param gb gameboy state struct
+ * @param loc GB_KEY1, GB_VBK or GB_SVBK
+ * @param data byte to write
+ */
+static void memory_cgb_write(struct gb_s *gb, uint16_t loc, uint8_t data)
+{
+    uint8_t *reg = &gb->memory.ram[loc - 0x8000];
+
+    switch (loc)
+    {
+    case GB_KEY1:
+        // Only the switch request is writable
+        *reg = (*reg & KEY1_DOUBLE) | 0x7E | (data & KEY1_PREPARE);
+        return;
+
+    case GB_VBK:
+        *reg = 0xFE | data;
+        break;
+
+    case GB_SVBK:
+        *reg = 0xF8 | data;
+        break;
+    }
+
+    memory_map(gb);
+}
+
+/**
+ * @brief Write byte to a memory bank controller register
+ *
+ * @param gb gameboy state struct
+ * @param loc address below 0x8000
+ * @param data byte to write
+ * @param type controller of the cartridge, a constant
+ */
+static inline __attribute__((always_inline)) void memory_mbc_write(struct gb_s *gb, uint16_t loc, uint8_t data,
+                                                                   const mbc_type_t type)
+{
+    struct mbc_s *mbc = &gb->memory.mbc;
+
+    switch (loc >> 13)
+    {
+    case 0:
+        mbc->ram_enable = (data & 0x0F) == 0x0A;
+        break;
+
+    case 1:
+        if (type == MBC_1)
+            mbc->rom_bank = data & 0x1F;
+        else if (type == MBC_3)
+            mbc->rom_bank = data & 0x7F;
+        else if (loc < 0x3000)
+            mbc->rom_bank = (mbc->rom_bank & 0x100) | data;
+        else
+            mbc->rom_bank = (mbc->rom_bank & 0xFF) | (data & 0x01) << 8;
+        break;
+
+    case 2:
+        mbc->ram_bank = data & (type == MBC_1 ? 0x03 : 0x0F);
+        break;
+
+    case 3:
+        // MBC3 RTC latch is ignored, the MBC5 has nothing here
+        if (type != MBC_1)
+            return;
+        mbc->mode = data & 0x01;
+        break;
+    }
+
+    memory_map(gb);
+}
 
 /**
  * @brief Read byte from memory
@@ -11,19 +222,35 @@
  *
  * @param gb gameboy state struct
  * @param loc 16-bit memory address to read from
+ * @param type controller of the cartridge, a constant
  * @return uint8_t byte at memory address
  */
-uint8_t mem_read_byte(struct gb_s *gb, uint16_t loc)
+static inline __attribute__((always_inline)) uint8_t memory_read(struct gb_s *gb, uint16_t loc, const mbc_type_t type)
 {
-    if (loc < 0x8000)
+    if (type == MBC_NONE && loc < 0x8000)
     {
         return gb->memory.rom[loc];
     }
-    else if (loc == 0xFF44)
+    else if (loc < 0xE000)
+    {
+        return gb->memory.page[loc >> 12][loc & (MEMORY_PAGE_SIZE - 1)];
+    }
+    else if (loc == GB_JOYP)
+    {
+        return joypad_read(gb);
+    }
+    else if (loc == GB_LY)
+    {
+        // gameboy-doctor logs are recorded with LY fixed at 0x90
+        return gb->gbdoc ? 0x90 : ppu_read_ly(gb);
+    }
+    else if (loc == GB_STAT)
     {
-        // LY register read debug implementation
-        // to work with gameboy doctor logs
-        return 0x90;
+        return ppu_read_stat(gb);
+    }
+    else if (loc >= GB_NR10 && loc < GB_LCDC)
+    {
+        return apu_read(gb, loc);
     }
     else
     {
@@ -32,19 +259,79 @@ uint8_t mem_read_byte(struct gb_s *gb, uint16_t loc)
 }
 
 /**
- * @brief Read byte from memory
+ * @brief Write byte to memory
  *
  * Does not advance cycles!
  *
  * @param gb gameboy state struct
  * @param loc 16-bit memory address to write to
  * @param data byte to write
+ * @param type controller of the cartridge, a constant
  */
-void mem_write_byte(struct gb_s *gb, uint16_t loc, uint8_t data)
+static inline __attribute__((always_inline)) void memory_write(struct gb_s *gb, uint16_t loc, uint8_t data,
+                                                               const mbc_type_t type)
 {
     if (loc < 0x8000)
-        // Protect ROM from writes
+    {
+        // ROM itself is never written
+        if (type != MBC_NONE)
+            memory_mbc_write(gb, loc, data, type);
         return;
+    }
+
+    if (gb->dma.oam_active && loc < 0xFF00)
+        // Only HRAM and the I/O registers are reachable during OAM DMA
+        return;
+
+    if (loc == GB_DMA)
+    {
+        dma_write(gb, data);
+        return;
+    }
+
+    if (loc < 0xA000 && gb->memory.page[0x8] == gb->memory.vram1)
+    {
+        // Not drawn, the renderer only knows bank 0
+        gb->memory.vram1[loc - 0x8000] = data;
+        return;
+    }
+
+    if (ppu_is_video_addr(loc))
+    {
+        ppu_write(gb, loc, data);
+        return;
+    }
+
+    if (loc == GB_JOYP)
+    {
+        joypad_write(gb, data);
+        return;
+    }
+
+    if (loc >= GB_NR10 && loc < GB_LCDC)
+    {
+        // Sound registers and wave RAM
+        apu_write(gb, loc, data);
+        return;
+    }
+
+    if (loc == GB_SC)
+    {
+        serial_write_control(gb, data);
+        return;
+    }
+
+    if (gb->cgb && (loc == GB_KEY1 || loc == GB_VBK || loc == GB_SVBK))
+    {
+        memory_cgb_write(gb, loc, data);
+        return;
+    }
+
+    if (gb->cgb && loc == GB_HDMA5)
+    {
+        dma_hdma_write(gb, data);
+        return;
+    }
 
     if (loc == GB_DIV)
     {
@@ -52,5 +339,128 @@ void mem_write_byte(struct gb_s *gb, uint16_t loc, uint8_t data)
         data = 0x00;
     }
 
-    gb->memory.ram[loc - 0x8000] = data;
+    if (loc < 0xE000)
+    {
+        uint8_t *page = gb->memory.page[loc >> 12];
+
+        if (type != MBC_NONE && page == memory_open_bus)
+            return;
+
+        page[loc & (MEMORY_PAGE_SIZE - 1)] = data;
+        if ((loc & 0xE000) == 0xA000 && gb->memory.save)
+            save_mark(gb->memory.save, &page[loc & (MEMORY_PAGE_SIZE - 1)] - gb->memory.cart_ram);
+    }
+    else
+        gb->memory.ram[loc - 0x8000] = data;
+}
+
+// Bus handlers per controller type
+#define MEMORY_BUS(name, type)                                                                                         \
+    static uint8_t mem_read_##name(struct gb_s *gb, uint16_t loc)                                                      \
+    {                                                                                                                  \
+        return memory_read(gb, loc, type);                                                                             \
+    }                                                                                                                  \
+    static void mem_write_##name(struct gb_s *gb, uint16_t loc, uint8_t data)                                          \
+    {                                                                                                                  \
+        memory_write(gb, loc, data, type);                                                                             \
+    }
+
+MEMORY_BUS(none, MBC_NONE)
+MEMORY_BUS(mbc1, MBC_1)
+MEMORY_BUS(mbc3, MBC_3)
+MEMORY_BUS(mbc5, MBC_5)
+
+static const struct
+{
+    uint8_t (*read)(struct gb_s *gb, uint16_t loc);
+    void (*write)(struct gb_s *gb, uint16_t loc, uint8_t data);
+} memory_bus[MBC_NUM_TYPES] = {
+    [MBC_NONE] = {mem_read_none, mem_write_none},
+    [MBC_1] = {mem_read_mbc1, mem_write_mbc1},
+    [MBC_3] = {mem_read_mbc3, mem_write_mbc3},
+    [MBC_5] = {mem_read_mbc5, mem_write_mbc5},
+};
+
+/**
+ * @brief Read byte from memory during OAM DMA
+ *
+ * Keeps the check off the regular handlers.
+ *
+ * @param gb gameboy state struct
+ * @param loc 16-bit memory address to read from
+ * @return uint8_t byte at memory address
+ */
+static uint8_t mem_read_oam_dma(struct gb_s *gb, uint16_t loc)
+{
+    // Only HRAM and the I/O registers are reachable during OAM DMA
+    if (loc < 0xFF00)
+        return 0xFF;
+
+    return memory_bus[gb->memory.mbc.type].read(gb, loc);
+}
+
+/**
+ * @brief Installs the read handler for the controller and OAM DMA state
+ *
+ * Called whenever an OAM DMA transfer starts or ends.
+ *
+ * @param gb gameboy state struct
+ */
+void memory_select_read(struct gb_s *gb)
+{
+    gb->memory.read = gb->dma.oam_active ? mem_read_oam_dma : memory_bus[gb->memory.mbc.type].read;
+}
+
+/**
+ * @brief Returns the memory bank controller of a cartridge type
+ *
+ * @param cart_type cartridge type byte of the ROM header
+ * @return mbc_type_t controller, MBC_NONE for unsupported ones
+ */
+mbc_type_t memory_mbc_type(uint8_t cart_type)
+{
+    switch (cart_type)
+    {
+    case 0x01: // MBC1
+    case 0x02: // MBC1+RAM
+    case 0x03: // MBC1+RAM+BATTERY
+        return MBC_1;
+    case 0x0F: // MBC3+TIMER+BATTERY
+    case 0x10: // MBC3+TIMER+RAM+BATTERY
+    case 0x11: // MBC3
+    case 0x12: // MBC3+RAM
+    case 0x13: // MBC3+RAM+BATTERY
+        return MBC_3;
+    case 0x19: // MBC5
+    case 0x1A: // MBC5+RAM
+    case 0x1B: // MBC5+RAM+BATTERY
+    case 0x1C: // MBC5+RUMBLE
+    case 0x1D: // MBC5+RUMBLE+RAM
+    case 0x1E: // MBC5+RUMBLE+RAM+BATTERY
+        return MBC_5;
+    default:
+        return MBC_NONE;
+    }
+}
+
+/**
+ * @brief Installs the bus handlers of a memory bank controller
+ *
+ * Resets the controller to its power on state.
+ *
+ * @param gb gameboy state struct
+ * @param type controller of the cartridge
+ */
+void memory_set_mbc(struct gb_s *gb, mbc_type_t type)
+{
+    struct memory_s *memory = &gb->memory;
+
+    memory->write = memory_bus[type].write;
+
+    memset(&memory->mbc, 0, sizeof(memory->mbc));
+    memory->mbc.type = type;
+    memory_select_read(gb);
+    // Without a controller, RAM (if any) is always there
+    memory->mbc.ram_enable = type == MBC_NONE;
+    memory_map(gb);
 }
\ No newline at end of file
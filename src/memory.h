@@ -1,14 +1,64 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
+
+#define MEMORY_PAGE_SIZE 0x1000
+#define MEMORY_NUM_PAGES 14 // 0x0000 - 0xDFFF, everything above is never banked
+
+#define KEY1_PREPARE 0x01 // Switch speed on the next STOP
+#define KEY1_DOUBLE 0x80  // Running at double speed
+
+#define MEMORY_ROM_BANK 0x4000
+#define MEMORY_RAM_BANK 0x2000
+#define MEMORY_MAX_ROM 0x800000 // 8 MiB, 512 banks of the MBC5
+
+struct gb_s;
+
+/* Memory bank controllers, each has its own bus handlers */
+typedef enum mbc_type
+{
+    MBC_NONE,
+    MBC_1,
+    MBC_3,
+    MBC_5,
+    MBC_NUM_TYPES
+} mbc_type_t;
+
+/* Memory bank controller registers, as last written */
+struct mbc_s
+{
+    mbc_type_t type;
+    bool ram_enable;   // 0x0000 - 0x1FFF
+    uint16_t rom_bank; // 0x2000 - 0x3FFF, 9 bits over two registers on the MBC5
+    uint8_t ram_bank;  // 0x4000 - 0x5FFF, upper ROM bank bits on the MBC1, RTC register select on the MBC3
+    bool mode;         // 0x6000 - 0x7FFF, MBC1 banking mode
+};
 
 struct memory_s
 {
-    uint8_t rom[0x8000];
-    uint8_t ram[0x8000];
+    // Bus handlers of the cartridge type, see memory_set_mbc() and memory_select_read()
+    uint8_t (*read)(struct gb_s *gb, uint16_t loc);
+    void (*write)(struct gb_s *gb, uint16_t loc, uint8_t data);
+
+    uint8_t *rom;      // Whole cartridge, never written
+    uint32_t rom_size; // Power of two, at least two banks
+    struct mbc_s mbc;
+    uint8_t ram[0x8000];               // 0x8000 - 0xFFFF, holds VRAM bank 0 and WRAM banks 0 and 1
+    uint8_t vram1[0x2000];             // CGB VRAM bank 1
+    uint8_t wram[6][MEMORY_PAGE_SIZE]; // CGB WRAM banks 2-7
+    uint8_t *page[MEMORY_NUM_PAGES];   // Memory seen by the CPU per 4 KiB page, follows VBK and SVBK
+
+    // Host connections, kept by gb_load_state()
+    uint8_t *cart_ram;      // Cartridge RAM, NULL maps the window to ram[]
+    uint32_t cart_ram_size; // Power of two, at least one bank
+    struct save_s *save;    // Save file behind cart_ram, told about writes
 };
 
-struct gb_s;
+void memory_map(struct gb_s *gb);
+void memory_set_mbc(struct gb_s *gb, mbc_type_t type);
+void memory_select_read(struct gb_s *gb);
+mbc_type_t memory_mbc_type(uint8_t cart_type);
+void memory_detach_save(struct gb_s *gb);
 
-uint8_t mem_read_byte(struct gb_s *gb, uint16_t loc);
-void mem_write_byte(struct gb_s *gb, uint16_t loc, uint8_t data);
\ No newline at end of file
+// mem_read_byte() and mem_write_byte() call the handlers, see gb.h
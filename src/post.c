@@ -0,0 +1,630 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "post.h"
+#include "ppu.h"
+#include "tribuf.h"
+#include "video.h"
+
+/*
+ * Post-processing
+ *
+ * Frames are converted to host pixels and run through a chain of
+ * filters (LCD ghosting, Scale2x/Scale3x, nearest neighbour scaling)
+ * on a worker thread of their own. The emulation only publishes shades
+ * and wakes the worker, so a slow filter chain drops frames on the way
+ * to the screen but never slows down the emulation. Stages can be
+ * toggled while running; each one is timed.
+ *
+ * The filters work on 4 pixels at a time with SSE2 or NEON where
+ * available. Image widths are always multiples of 160, so there is no
+ * remainder to handle.
+ */
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+typedef __m128i post_vec_t;
+#define POST_LANES 4
+#define vec_load(p) _mm_loadu_si128((const __m128i *)(p))
+#define vec_store(p, v) _mm_storeu_si128((__m128i *)(p), v)
+#define vec_ones() _mm_set1_epi32(-1)
+#define vec_eq(a, b) _mm_cmpeq_epi32(a, b)
+#define vec_and(a, b) _mm_and_si128(a, b)
+#define vec_or(a, b) _mm_or_si128(a, b)
+#define vec_andnot(a, b) _mm_andnot_si128(a, b) // ~a & b
+#define vec_avg(a, b) _mm_avg_epu8(a, b)
+
+static inline void vec_store2(uint32_t *p, post_vec_t a, post_vec_t b)
+{
+    vec_store(p, _mm_unpacklo_epi32(a, b));
+    vec_store(p + 4, _mm_unpackhi_epi32(a, b));
+}
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+
+typedef uint32x4_t post_vec_t;
+#define POST_LANES 4
+#define vec_load(p) vld1q_u32(p)
+#define vec_store(p, v) vst1q_u32(p, v)
+#define vec_ones() vdupq_n_u32(~0u)
+#define vec_eq(a, b) vceqq_u32(a, b)
+#define vec_and(a, b) vandq_u32(a, b)
+#define vec_or(a, b) vorrq_u32(a, b)
+#define vec_andnot(a, b) vbicq_u32(b, a) // ~a & b
+#define vec_avg(a, b) vreinterpretq_u32_u8(vrhaddq_u8(vreinterpretq_u8_u32(a), vreinterpretq_u8_u32(b)))
+
+static inline void vec_store2(uint32_t *p, post_vec_t a, post_vec_t b)
+{
+    uint32x4x2_t v = {{a, b}};
+    vst2q_u32(p, v);
+}
+#else
+typedef uint32_t post_vec_t;
+#define POST_LANES 1
+#define vec_load(p) (*(p))
+#define vec_store(p, v) (*(p) = (v))
+#define vec_ones() (~0u)
+#define vec_eq(a, b) ((a) == (b) ? ~0u : 0u)
+#define vec_and(a, b) ((a) & (b))
+#define vec_or(a, b) ((a) | (b))
+#define vec_andnot(a, b) (~(a) & (b))
+// Per byte average, rounded up like the SIMD versions
+#define vec_avg(a, b) (((a) | (b)) - ((((a) ^ (b)) >> 1) & 0x7F7F7F7F))
+
+static inline void vec_store2(uint32_t *p, post_vec_t a, post_vec_t b)
+{
+    p[0] = a;
+    p[1] = b;
+}
+#endif
+
+// Picks a where the mask is set, b elsewhere
+#define vec_sel(mask, a, b) vec_or(vec_and(mask, a), vec_andnot(mask, b))
+
+static inline void vec_store3(uint32_t *p, post_vec_t a, post_vec_t b, post_vec_t c)
+{
+    uint32_t ta[POST_LANES], tb[POST_LANES], tc[POST_LANES];
+
+    vec_store(ta, a);
+    vec_store(tb, b);
+    vec_store(tc, c);
+
+    for (int i = 0; i < POST_LANES; i++)
+    {
+        p[i * 3] = ta[i];
+        p[i * 3 + 1] = tb[i];
+        p[i * 3 + 2] = tc[i];
+    }
+}
+
+static const struct
+{
+    const char *name;
+    uint8_t scale;
+} post_stages[POST_NUM_STAGES] = {
+    [POST_GHOST] = {"ghost", 1},
+    [POST_SCALE2X] = {"scale2x", 2},
+    [POST_SCALE3X] = {"scale3x", 3},
+    [POST_INT2] = {"int2", 2},
+    [POST_INT3] = {"int3", 3},
+    [POST_INT4] = {"int4", 4},
+};
+
+static uint64_t post_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+const char *post_stage_name(post_stage_t stage)
+{
+    return stage < POST_NUM_STAGES ? post_stages[stage].name : "?";
+}
+
+/**
+ * @brief Parses a comma separated list of stage names
+ *
+ * @param chain receives the stages
+ * @param list e.g. "ghost,scale3x"
+ * @return int 0 on success
+ */
+int post_parse_chain(struct post_chain_s *chain, const char *list)
+{
+    unsigned scale = 1;
+
+    chain->count = 0;
+
+    while (*list)
+    {
+        size_t len = strcspn(list, ",");
+        int stage;
+
+        for (stage = 0; stage < POST_NUM_STAGES; stage++)
+        {
+            if (strlen(post_stages[stage].name) == len && strncmp(list, post_stages[stage].name, len) == 0)
+                break;
+        }
+
+        if (stage == POST_NUM_STAGES)
+        {
+            printf("Unknown post-processing stage '%.*s'\n", (int)len, list);
+            return -1;
+        }
+
+        if (chain->count == POST_MAX_STAGES)
+        {
+            printf("At most %d post-processing stages are supported\n", POST_MAX_STAGES);
+            return -1;
+        }
+
+        scale *= post_stages[stage].scale;
+        chain->stages[chain->count++] = stage;
+
+        list += len;
+        if (*list == ',')
+            list++;
+    }
+
+    if (scale > POST_MAX_SCALE)
+    {
+        printf("Post-processing chain scales by %u, at most %d is supported\n", scale, POST_MAX_SCALE);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Blends a frame with the previous output
+ *
+ * The DMG LCD reacts slowly, so moving or flickering objects leave a
+ * trail. Each output pixel is the average of the input and the previous
+ * output, which decays like the liquid crystals.
+ *
+ * @param post post-processing state
+ * @param pos chain position of the stage
+ * @param in input image
+ * @param out output image
+ */
+static void post_ghost(struct post_s *post, unsigned pos, const struct post_image_s *in, struct post_image_s *out)
+{
+    uint32_t size = in->width * in->height;
+    uint32_t *history = post->history[pos];
+
+    out->width = in->width;
+    out->height = in->height;
+
+    if (post->history_size[pos] != size)
+    {
+        // Just enabled, or an earlier stage changed the resolution
+        memcpy(history, in->pixels, size * sizeof(*history));
+        post->history_size[pos] = size;
+    }
+
+    for (uint32_t i = 0; i < size; i += POST_LANES)
+    {
+        post_vec_t v = vec_avg(vec_load(&in->pixels[i]), vec_load(&history[i]));
+
+        vec_store(&out->pixels[i], v);
+        vec_store(&history[i], v);
+    }
+}
+
+/**
+ * @brief Copies an image with a one pixel border of repeated edge pixels
+ *
+ * Lets the scalers read all neighbours without bounds checks.
+ *
+ * @param post post-processing state
+ * @param in input image
+ */
+static void post_pad(struct post_s *post, const struct post_image_s *in)
+{
+    uint32_t w = in->width;
+    uint32_t stride = w + 2;
+
+    for (int y = -1; y <= (int)in->height; y++)
+    {
+        int src_y = y < 0 ? 0 : (y == (int)in->height ? y - 1 : y);
+        const uint32_t *src = &in->pixels[src_y * w];
+        uint32_t *dst = &post->pad[(y + 1) * stride];
+
+        dst[0] = src[0];
+        memcpy(&dst[1], src, w * sizeof(*src));
+        dst[w + 1] = src[w - 1];
+    }
+}
+
+/**
+ * @brief Scale2x: doubles the size, rounding off diagonal edges
+ *
+ * Neighbours of E:  B
+ *                  D E F
+ *                    H
+ *
+ * @param pad padded input, see post_pad()
+ * @param w input width
+ * @param h input height
+ * @param out output image
+ */
+static void post_scale2x(const uint32_t *pad, uint32_t w, uint32_t h, struct post_image_s *out)
+{
+    uint32_t stride = w + 2;
+
+    out->width = w * 2;
+    out->height = h * 2;
+
+    for (uint32_t y = 0; y < h; y++)
+    {
+        const uint32_t *up = &pad[y * stride + 1];
+        const uint32_t *mid = up + stride;
+        const uint32_t *down = mid + stride;
+        uint32_t *out0 = &out->pixels[y * 2 * out->width];
+        uint32_t *out1 = out0 + out->width;
+
+        for (int x = 0; x < (int)w; x += POST_LANES)
+        {
+            post_vec_t b = vec_load(&up[x]);
+            post_vec_t d = vec_load(&mid[x - 1]);
+            post_vec_t e = vec_load(&mid[x]);
+            post_vec_t f = vec_load(&mid[x + 1]);
+            post_vec_t h = vec_load(&down[x]);
+
+            // Only pixels on an edge are changed
+            post_vec_t edge = vec_andnot(vec_or(vec_eq(b, h), vec_eq(d, f)), vec_ones());
+
+            vec_store2(&out0[x * 2], vec_sel(vec_and(edge, vec_eq(d, b)), d, e),
+                       vec_sel(vec_and(edge, vec_eq(b, f)), f, e));
+            vec_store2(&out1[x * 2], vec_sel(vec_and(edge, vec_eq(d, h)), d, e),
+                       vec_sel(vec_and(edge, vec_eq(h, f)), f, e));
+        }
+    }
+}
+
+/**
+ * @brief Scale3x: triples the size, rounding off diagonal edges
+ *
+ * Neighbours of E: A B C
+ *                  D E F
+ *                  G H I
+ *
+ * @param pad padded input, see post_pad()
+ * @param w input width
+ * @param h input height
+ * @param out output image
+ */
+static void post_scale3x(const uint32_t *pad, uint32_t w, uint32_t h, struct post_image_s *out)
+{
+    uint32_t stride = w + 2;
+
+    out->width = w * 3;
+    out->height = h * 3;
+
+    for (uint32_t y = 0; y < h; y++)
+    {
+        const uint32_t *up = &pad[y * stride + 1];
+        const uint32_t *mid = up + stride;
+        const uint32_t *down = mid + stride;
+        uint32_t *out0 = &out->pixels[y * 3 * out->width];
+        uint32_t *out1 = out0 + out->width;
+        uint32_t *out2 = out1 + out->width;
+
+        for (int x = 0; x < (int)w; x += POST_LANES)
+        {
+            post_vec_t a = vec_load(&up[x - 1]);
+            post_vec_t b = vec_load(&up[x]);
+            post_vec_t c = vec_load(&up[x + 1]);
+            post_vec_t d = vec_load(&mid[x - 1]);
+            post_vec_t e = vec_load(&mid[x]);
+            post_vec_t f = vec_load(&mid[x + 1]);
+            post_vec_t g = vec_load(&down[x - 1]);
+            post_vec_t h = vec_load(&down[x]);
+            post_vec_t i = vec_load(&down[x + 1]);
+
+            post_vec_t edge = vec_andnot(vec_or(vec_eq(b, h), vec_eq(d, f)), vec_ones());
+            post_vec_t db = vec_and(edge, vec_eq(d, b));
+            post_vec_t bf = vec_and(edge, vec_eq(b, f));
+            post_vec_t dh = vec_and(edge, vec_eq(d, h));
+            post_vec_t hf = vec_and(edge, vec_eq(h, f));
+
+            // X && E != Y is vec_andnot(E == Y, X)
+            vec_store3(&out0[x * 3], vec_sel(db, d, e),
+                       vec_sel(vec_or(vec_andnot(vec_eq(e, c), db), vec_andnot(vec_eq(e, a), bf)), b, e),
+                       vec_sel(bf, f, e));
+            vec_store3(&out1[x * 3],
+                       vec_sel(vec_or(vec_andnot(vec_eq(e, g), db), vec_andnot(vec_eq(e, a), dh)), d, e), e,
+                       vec_sel(vec_or(vec_andnot(vec_eq(e, i), bf), vec_andnot(vec_eq(e, c), hf)), f, e));
+            vec_store3(&out2[x * 3], vec_sel(dh, d, e),
+                       vec_sel(vec_or(vec_andnot(vec_eq(e, i), dh), vec_andnot(vec_eq(e, g), hf)), h, e),
+                       vec_sel(hf, f, e));
+        }
+    }
+}
+
+/**
+ * @brief Nearest neighbour scaling by an integer factor
+ *
+ * @param in input image
+ * @param out output image
+ * @param n scale factor
+ */
+static void post_scale_int(const struct post_image_s *in, struct post_image_s *out, uint32_t n)
+{
+    out->width = in->width * n;
+    out->height = in->height * n;
+
+    for (uint32_t y = 0; y < in->height; y++)
+    {
+        const uint32_t *src = &in->pixels[y * in->width];
+        uint32_t *dst = &out->pixels[y * n * out->width];
+
+        if (n == 2)
+        {
+            for (uint32_t x = 0; x < in->width; x += POST_LANES)
+            {
+                post_vec_t v = vec_load(&src[x]);
+                vec_store2(&dst[x * 2], v, v);
+            }
+        }
+        else if (n == 3)
+        {
+            for (uint32_t x = 0; x < in->width; x += POST_LANES)
+            {
+                post_vec_t v = vec_load(&src[x]);
+                vec_store3(&dst[x * 3], v, v, v);
+            }
+        }
+        else
+        {
+            for (uint32_t x = 0; x < in->width; x++)
+            {
+                for (uint32_t k = 0; k < n; k++)
+                    dst[x * n + k] = src[x];
+            }
+        }
+
+        for (uint32_t row = 1; row < n; row++)
+            memcpy(&dst[row * out->width], dst, out->width * sizeof(*dst));
+    }
+}
+
+static void post_run_stage(struct post_s *post, unsigned pos, const struct post_image_s *in, struct post_image_s *out)
+{
+    switch (post->chain.stages[pos])
+    {
+    case POST_GHOST:
+        post_ghost(post, pos, in, out);
+        break;
+
+    case POST_SCALE2X:
+        post_pad(post, in);
+        post_scale2x(post->pad, in->width, in->height, out);
+        break;
+
+    case POST_SCALE3X:
+        post_pad(post, in);
+        post_scale3x(post->pad, in->width, in->height, out);
+        break;
+
+    case POST_INT2:
+        post_scale_int(in, out, 2);
+        break;
+
+    case POST_INT3:
+        post_scale_int(in, out, 3);
+        break;
+
+    case POST_INT4:
+        post_scale_int(in, out, 4);
+        break;
+    }
+}
+
+/**
+ * @brief Converts a frame and runs it through the enabled stages
+ *
+ * The last enabled stage writes straight into the published frame.
+ *
+ * @param post post-processing state
+ * @param shades 160x144 shades
+ * @param frame receives the processed frame
+ */
+static void post_process(struct post_s *post, const uint8_t *shades, struct post_frame_s *frame)
+{
+    unsigned enabled = atomic_load_explicit(&post->enabled, memory_order_relaxed);
+    int last = -1;
+
+    for (unsigned pos = 0; pos < post->chain.count; pos++)
+    {
+        if (enabled & ~post->last_enabled & (1u << pos))
+            post->history_size[pos] = 0;
+        if (enabled & (1u << pos))
+            last = pos;
+    }
+    post->last_enabled = enabled;
+
+    struct post_image_s image = {last < 0 ? frame->pixels : post->work[0], GB_LCD_WIDTH, GB_LCD_HEIGHT};
+    uint64_t start = post_now_ns();
+    int work = 1;
+
+    video_convert(&post->palette, VIDEO_FORMAT_RGBA8888, shades, image.pixels, GB_LCD_WIDTH * sizeof(uint32_t));
+    atomic_fetch_add_explicit(&post->convert_ns, post_now_ns() - start, memory_order_relaxed);
+
+    for (int pos = 0; pos <= last; pos++)
+    {
+        if (!(enabled & (1u << pos)))
+            continue;
+
+        struct post_image_s out = {.pixels = pos == last ? frame->pixels : post->work[work]};
+
+        start = post_now_ns();
+        post_run_stage(post, pos, &image, &out);
+        atomic_fetch_add_explicit(&post->stage_ns[pos], post_now_ns() - start, memory_order_relaxed);
+
+        image = out;
+        work ^= 1;
+    }
+
+    frame->width = image.width;
+    frame->height = image.height;
+}
+
+static void *post_main(void *arg)
+{
+    struct post_s *post = arg;
+
+    pthread_mutex_lock(&post->lock);
+
+    while (true)
+    {
+        while (!post->pending && !post->quit)
+            pthread_cond_wait(&post->cond, &post->lock);
+
+        if (post->quit)
+            break;
+
+        post->pending = false;
+        pthread_mutex_unlock(&post->lock);
+
+        if (tribuf_acquire(post->input))
+        {
+            post_process(post, tribuf_front(post->input), (struct post_frame_s *)tribuf_back(&post->output));
+            tribuf_publish(&post->output);
+            atomic_fetch_add_explicit(&post->frames, 1, memory_order_relaxed);
+        }
+
+        pthread_mutex_lock(&post->lock);
+    }
+
+    pthread_mutex_unlock(&post->lock);
+    return NULL;
+}
+
+static void post_free(struct post_s *post)
+{
+    free(post->work[0]);
+    free(post->work[1]);
+    free(post->pad);
+    for (int pos = 0; pos < POST_MAX_STAGES; pos++)
+        free(post->history[pos]);
+    tribuf_free(&post->output);
+}
+
+/**
+ * @brief Starts the post-processing worker
+ *
+ * All stages of the chain start out enabled.
+ *
+ * @param post post-processing state
+ * @param chain stages to apply
+ * @param input triple buffer the emulation publishes shades to, read by the worker only
+ * @return int 0 on success
+ */
+int post_start(struct post_s *post, const struct post_chain_s *chain, struct tribuf_s *input)
+{
+    uint32_t side = 1; // Scale factor at the current chain position
+    size_t pad_pixels = 0;
+    bool ok = true;
+
+    memset(post, 0, sizeof(*post));
+    post->input = input;
+    post->chain = *chain;
+    video_palette_init(&post->palette, NULL);
+
+    for (unsigned pos = 0; pos < chain->count; pos++)
+    {
+        size_t width = GB_LCD_WIDTH * side;
+        size_t height = GB_LCD_HEIGHT * side;
+
+        if (chain->stages[pos] == POST_GHOST)
+            ok &= (post->history[pos] = malloc(width * height * sizeof(uint32_t))) != NULL;
+        else if ((width + 2) * (height + 2) > pad_pixels)
+            pad_pixels = (width + 2) * (height + 2);
+
+        side *= post_stages[chain->stages[pos]].scale;
+    }
+
+    size_t max_pixels = GB_LCD_WIDTH * side * GB_LCD_HEIGHT * side;
+
+    if (pad_pixels)
+        ok &= (post->pad = malloc(pad_pixels * sizeof(uint32_t))) != NULL;
+    ok &= (post->work[0] = malloc(max_pixels * sizeof(uint32_t))) != NULL;
+    ok &= (post->work[1] = malloc(max_pixels * sizeof(uint32_t))) != NULL;
+
+    if (!ok || tribuf_init(&post->output, sizeof(struct post_frame_s) + max_pixels * sizeof(uint32_t)) != 0)
+    {
+        printf("Could not allocate post-processing buffers\n");
+        post_free(post);
+        return -1;
+    }
+
+    atomic_init(&post->enabled, (1u << chain->count) - 1);
+    post->last_enabled = atomic_load(&post->enabled);
+
+    pthread_mutex_init(&post->lock, NULL);
+    pthread_cond_init(&post->cond, NULL);
+
+    if (pthread_create(&post->thread, NULL, post_main, post) != 0)
+    {
+        printf("Could not start post-processing worker\n");
+        pthread_cond_destroy(&post->cond);
+        pthread_mutex_destroy(&post->lock);
+        post_free(post);
+        return -1;
+    }
+
+    return 0;
+}
+
+void post_stop(struct post_s *post)
+{
+    pthread_mutex_lock(&post->lock);
+    post->quit = true;
+    pthread_cond_broadcast(&post->cond);
+    pthread_mutex_unlock(&post->lock);
+    pthread_join(post->thread, NULL);
+
+    pthread_cond_destroy(&post->cond);
+    pthread_mutex_destroy(&post->lock);
+    post_free(post);
+}
+
+/**
+ * @brief Wakes the worker after a frame was published to the input
+ *
+ * Only takes the lock briefly, the emulation never waits for processing.
+ *
+ * @param post post-processing state
+ */
+void post_kick(struct post_s *post)
+{
+    pthread_mutex_lock(&post->lock);
+    post->pending = true;
+    pthread_cond_signal(&post->cond);
+    pthread_mutex_unlock(&post->lock);
+}
+
+/**
+ * @brief Enables or disables a stage of the chain
+ *
+ * Takes effect with the next frame.
+ *
+ * @param post post-processing state
+ * @param pos chain position
+ * @return true if the stage is enabled now
+ */
+bool post_toggle(struct post_s *post, unsigned pos)
+{
+    if (pos >= post->chain.count)
+        return false;
+
+    return !(atomic_fetch_xor(&post->enabled, 1u << pos) & (1u << pos));
+}
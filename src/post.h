@@ -0,0 +1,80 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "tribuf.h"
+#include "video.h"
+
+#define POST_MAX_STAGES 4
+#define POST_MAX_SCALE 6 // Largest total scale factor of a chain
+
+/* Post-processing stages */
+typedef enum post_stage
+{
+    POST_GHOST,   // Blend with the previous frame like the slow DMG LCD
+    POST_SCALE2X, // Edge-preserving 2x (EPX/Scale2x)
+    POST_SCALE3X, // Edge-preserving 3x (Scale3x)
+    POST_INT2,    // Nearest neighbour 2x
+    POST_INT3,    // Nearest neighbour 3x
+    POST_INT4,    // Nearest neighbour 4x
+    POST_NUM_STAGES
+} post_stage_t;
+
+/* Stages in the order they are applied */
+struct post_chain_s
+{
+    uint8_t stages[POST_MAX_STAGES]; // post_stage_t
+    uint8_t count;
+};
+
+/* Processed frame, as published to the presenter */
+struct post_frame_s
+{
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixels[]; // 0xRRGGBBAA, width * height
+};
+
+/* Image passed between stages */
+struct post_image_s
+{
+    uint32_t *pixels;
+    uint32_t width;
+    uint32_t height;
+};
+
+/* Post-processing worker */
+struct post_s
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool pending; // A frame was published to the input
+    bool quit;
+
+    struct tribuf_s *input; // Shades, from the emulation
+    struct tribuf_s output; // struct post_frame_s, to the presenter
+    struct video_palette_s palette;
+    struct post_chain_s chain;
+    atomic_uint enabled;   // Bit per chain position
+    unsigned last_enabled; // Enabled bits of the previous frame, worker only
+
+    uint32_t *work[2];                   // Intermediate images
+    uint32_t *pad;                       // Input with a replicated border, for the scalers
+    uint32_t *history[POST_MAX_STAGES];  // Previous output of ghosting stages
+    uint32_t history_size[POST_MAX_STAGES];
+
+    // Time spent since the last report, in ns
+    atomic_uint_fast64_t convert_ns;
+    atomic_uint_fast64_t stage_ns[POST_MAX_STAGES];
+    atomic_uint_fast32_t frames;
+};
+
+int post_parse_chain(struct post_chain_s *chain, const char *list);
+const char *post_stage_name(post_stage_t stage);
+int post_start(struct post_s *post, const struct post_chain_s *chain, struct tribuf_s *input);
+void post_stop(struct post_s *post);
+void post_kick(struct post_s *post);
+bool post_toggle(struct post_s *post, unsigned pos);
@@ -0,0 +1,470 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include "gb.h"
+#include "cpu.h"
+#include "dma.h"
+#include "ppu.h"
+#include "sched.h"
+
+static inline uint8_t ppu_reg(struct gb_s *gb, uint16_t reg)
+{
+    return gb->memory.ram[reg - 0x8000];
+}
+
+/**
+ * @brief Returns the current dot within the frame
+ *
+ * @param gb gameboy state struct
+ * @return uint32_t dot since the start of line 0 (0-70223)
+ */
+static inline uint32_t ppu_frame_dot(struct gb_s *gb)
+{
+    return (gb->clock - gb->ppu.frame_start) % PPU_DOTS_PER_FRAME;
+}
+
+static inline uint8_t ppu_dot_mode(uint32_t dot)
+{
+    uint32_t line_dot = dot % PPU_DOTS_PER_LINE;
+
+    if (dot >= GB_LCD_HEIGHT * PPU_DOTS_PER_LINE)
+        return PPU_MODE_VBLANK;
+    if (line_dot < PPU_MODE3_START)
+        return PPU_MODE_OAM;
+    if (line_dot < PPU_MODE0_START)
+        return PPU_MODE_DRAW;
+
+    return PPU_MODE_HBLANK;
+}
+
+/**
+ * @brief Evaluates the STAT interrupt line at a dot of the frame
+ *
+ * @param stat STAT register value
+ * @param lyc LYC register value
+ * @param dot dot within the frame
+ * @return true if any enabled STAT source is active
+ */
+static bool ppu_stat_line(uint8_t stat, uint8_t lyc, uint32_t dot)
+{
+    uint8_t mode = ppu_dot_mode(dot);
+
+    return ((stat & STAT_LYC_INT) && dot / PPU_DOTS_PER_LINE == lyc) ||
+           ((stat & STAT_MODE0_INT) && mode == PPU_MODE_HBLANK) ||
+           ((stat & STAT_MODE1_INT) && mode == PPU_MODE_VBLANK) ||
+           ((stat & STAT_MODE2_INT) && mode == PPU_MODE_OAM);
+}
+
+/**
+ * @brief Schedules the next rising edge of the STAT interrupt line
+ *
+ * The line can only rise at the start of a line (mode 2, mode 1, LY=LYC)
+ * or at the start of mode 0, so only those points are checked.
+ *
+ * @param gb gameboy state struct
+ * @param after T-cycle timestamp the edge has to come after
+ */
+static void ppu_schedule_stat(struct gb_s *gb, uint64_t after)
+{
+    uint8_t stat = ppu_reg(gb, GB_STAT);
+    uint8_t lyc = ppu_reg(gb, GB_LYC);
+
+    if (!(stat & STAT_INT_MASK) || !(ppu_reg(gb, GB_LCDC) & LCDC_LCD_ENABLE))
+    {
+        sched_remove(gb, SCHED_PPU_STAT);
+        return;
+    }
+
+    uint32_t dot = (after - gb->ppu.frame_start) % PPU_DOTS_PER_FRAME;
+    uint64_t base = after - dot;
+
+    // Look one frame ahead, every enabled source fires at least once per frame
+    for (uint32_t line = dot / PPU_DOTS_PER_LINE; line <= 2 * PPU_LINES_PER_FRAME; line++)
+    {
+        uint32_t candidates[2] = {line * PPU_DOTS_PER_LINE, line * PPU_DOTS_PER_LINE + PPU_MODE0_START};
+
+        for (int i = 0; i < 2; i++)
+        {
+            uint32_t edge = candidates[i];
+            if (edge <= dot)
+                continue;
+
+            if (ppu_stat_line(stat, lyc, edge % PPU_DOTS_PER_FRAME) &&
+                !ppu_stat_line(stat, lyc, (edge - 1) % PPU_DOTS_PER_FRAME))
+            {
+                sched_add(gb, SCHED_PPU_STAT, base + edge);
+                return;
+            }
+        }
+    }
+
+    sched_remove(gb, SCHED_PPU_STAT);
+}
+
+/**
+ * @brief Read LY
+ *
+ * Computed from the clock, the PPU is not stepped to get it.
+ *
+ * @param gb gameboy state struct
+ * @return uint8_t current line
+ */
+uint8_t ppu_read_ly(struct gb_s *gb)
+{
+    if (!(ppu_reg(gb, GB_LCDC) & LCDC_LCD_ENABLE))
+        return 0;
+
+    return ppu_frame_dot(gb) / PPU_DOTS_PER_LINE;
+}
+
+/**
+ * @brief Read STAT
+ *
+ * Mode and LY=LYC bits are computed from the clock.
+ *
+ * @param gb gameboy state struct
+ * @return uint8_t STAT register value
+ */
+uint8_t ppu_read_stat(struct gb_s *gb)
+{
+    uint8_t stat = 0x80 | (ppu_reg(gb, GB_STAT) & STAT_INT_MASK);
+
+    if (ppu_read_ly(gb) == ppu_reg(gb, GB_LYC))
+        stat |= STAT_LYC_EQUAL;
+
+    if (ppu_reg(gb, GB_LCDC) & LCDC_LCD_ENABLE)
+        stat |= ppu_dot_mode(ppu_frame_dot(gb));
+
+    return stat;
+}
+
+/**
+ * @brief Write byte to STAT or LYC
+ *
+ * Raises the STAT interrupt if the write makes the interrupt line rise
+ * and reschedules its next edge.
+ *
+ * @param gb gameboy state struct
+ * @param loc GB_STAT or GB_LYC
+ * @param data byte to write
+ */
+static void ppu_stat_write(struct gb_s *gb, uint16_t loc, uint8_t data)
+{
+    bool lcd_on = ppu_reg(gb, GB_LCDC) & LCDC_LCD_ENABLE;
+    uint32_t dot = ppu_frame_dot(gb);
+    bool was_high = lcd_on && ppu_stat_line(ppu_reg(gb, GB_STAT), ppu_reg(gb, GB_LYC), dot);
+
+    if (loc == GB_STAT)
+        // Only the interrupt source bits are writable
+        data &= STAT_INT_MASK;
+
+    gb->memory.ram[loc - 0x8000] = data;
+
+    if (lcd_on && !was_high && ppu_stat_line(ppu_reg(gb, GB_STAT), ppu_reg(gb, GB_LYC), dot))
+        cpu_raise_interrupt(gb, IR_LCD);
+
+    ppu_schedule_stat(gb, gb->clock);
+}
+
+/**
+ * @brief Updates PPU timing after an LCDC write
+ *
+ * @param gb gameboy state struct
+ * @param old previous LCDC value
+ * @param data new LCDC value
+ */
+static void ppu_lcdc_timing(struct gb_s *gb, uint8_t old, uint8_t data)
+{
+    if ((old & LCDC_LCD_ENABLE) && !(data & LCDC_LCD_ENABLE))
+    {
+        // Turning the LCD off stops all PPU timing
+        sched_remove(gb, SCHED_PPU_LINE);
+        sched_remove(gb, SCHED_PPU_VBLANK);
+        sched_remove(gb, SCHED_PPU_STAT);
+        dma_hdma_lcd_switch(gb);
+    }
+    else if (!(old & LCDC_LCD_ENABLE) && (data & LCDC_LCD_ENABLE))
+    {
+        // Turning it back on restarts the frame at line 0
+        gb->ppu.frame_start = gb->clock;
+        sched_add(gb, SCHED_PPU_LINE, gb->clock + PPU_MODE3_START);
+        ppu_schedule_stat(gb, gb->clock);
+        dma_hdma_lcd_switch(gb);
+    }
+}
+
+/**
+ * @brief Write byte to VRAM, OAM or an LCD register
+ *
+ * Forwards the write to the renderer, or logs it for the render
+ * worker.
+ *
+ * @param gb gameboy state struct
+ * @param loc 16-bit memory address to write to
+ * @param data byte to write
+ */
+void ppu_write(struct gb_s *gb, uint16_t loc, uint8_t data)
+{
+    struct ppu_s *ppu = &gb->ppu;
+    uint8_t old = gb->memory.ram[loc - 0x8000];
+
+    switch (loc)
+    {
+    case GB_LY:
+        // Read-only
+        return;
+
+    case GB_STAT:
+    case GB_LYC:
+        ppu_stat_write(gb, loc, data);
+        return;
+    }
+
+    uint32_t dot = ppu_frame_dot(gb);
+
+    if (ppu->worker)
+    {
+        gb->memory.ram[loc - 0x8000] = data;
+        ppu_worker_log(ppu->worker, PPU_LOG_WRITE, dot, loc, data);
+    }
+    else
+    {
+        ppu_render_write(&ppu->render, loc, data, dot);
+    }
+
+    if (loc == GB_LCDC)
+        ppu_lcdc_timing(gb, old, data);
+}
+
+/**
+ * @brief Replaces OAM with the bytes of an OAM DMA transfer
+ *
+ * Only the changed bytes are passed to the render worker.
+ *
+ * @param gb gameboy state struct
+ * @param data GB_OAM_END - GB_OAM_START bytes
+ */
+void ppu_oam_dma(struct gb_s *gb, const uint8_t *data)
+{
+    struct ppu_s *ppu = &gb->ppu;
+    uint8_t *oam = &gb->memory.ram[GB_OAM_START - 0x8000];
+    uint32_t dot = ppu_frame_dot(gb);
+
+    if (!ppu->worker)
+    {
+        ppu_render_oam_dma(&ppu->render, data, dot);
+        return;
+    }
+
+    for (uint16_t i = 0; i < GB_OAM_END - GB_OAM_START; i++)
+    {
+        if (oam[i] == data[i])
+            continue;
+
+        oam[i] = data[i];
+        ppu_worker_log(ppu->worker, PPU_LOG_WRITE, dot, GB_OAM_START + i, data[i]);
+    }
+}
+
+/**
+ * @brief Writes a block of VRAM copied by DMA
+ *
+ * @param gb gameboy state struct
+ * @param loc 16-bit VRAM address of the first byte
+ * @param data bytes to write
+ * @param len number of bytes, the block must not leave VRAM
+ */
+void ppu_vram_dma(struct gb_s *gb, uint16_t loc, const uint8_t *data, uint16_t len)
+{
+    struct ppu_s *ppu = &gb->ppu;
+    uint32_t dot = ppu_frame_dot(gb);
+
+    if (!ppu->worker)
+    {
+        ppu_render_vram_dma(&ppu->render, loc, data, len, dot);
+        return;
+    }
+
+    memcpy(&gb->memory.ram[loc - 0x8000], data, len);
+    for (uint16_t i = 0; i < len; i++)
+        ppu_worker_log(ppu->worker, PPU_LOG_WRITE, dot, loc + i, data[i]);
+}
+
+void ppu_init(struct gb_s *gb)
+{
+    struct ppu_s *ppu = &gb->ppu;
+
+    memset(ppu, 0, sizeof(*ppu));
+    ppu->render.vram = &gb->memory.ram[0];
+    ppu->render.oam = &gb->memory.ram[GB_OAM_START - 0x8000];
+    ppu->render.regs = &gb->memory.ram[GB_LCDC - 0x8000];
+    ppu->render.framebuffer = ppu->framebuffer;
+    ppu_render_init(&ppu->render);
+
+    if (ppu_reg(gb, GB_LCDC) & LCDC_LCD_ENABLE)
+    {
+        ppu->frame_start = gb->clock;
+        sched_add(gb, SCHED_PPU_LINE, gb->clock + PPU_MODE3_START);
+        ppu_schedule_stat(gb, gb->clock);
+    }
+}
+
+/**
+ * @brief Selects the line renderer of an instance
+ *
+ * Must be called before the render worker is started. The pixel FIFO
+ * is only available when built with NYAN_PPU_FIFO, it is the default then.
+ *
+ * @param gb gameboy state struct
+ * @param renderer renderer to use
+ * @return int 0 on success, -1 if the renderer is not available
+ */
+int ppu_set_renderer(struct gb_s *gb, ppu_renderer_t renderer)
+{
+    if (gb->ppu.worker)
+    {
+        printf("The renderer can't be changed while the render worker runs\n");
+        return -1;
+    }
+
+#ifdef PPU_FIFO
+    gb->ppu.render.renderer = renderer;
+#else
+    if (renderer != PPU_RENDERER_SCANLINE)
+    {
+        printf("Pixel FIFO renderer not built, enable NYAN_PPU_FIFO\n");
+        return -1;
+    }
+#endif
+
+    return 0;
+}
+
+/**
+ * @brief Mode 3 start of a visible line
+ *
+ * @param gb gameboy state struct
+ * @param when T-cycle timestamp the event was scheduled for
+ */
+void ppu_line_event(struct gb_s *gb, uint64_t when)
+{
+    struct ppu_s *ppu = &gb->ppu;
+    uint32_t line = (when - ppu->frame_start) % PPU_DOTS_PER_FRAME / PPU_DOTS_PER_LINE;
+
+    if (line == 0)
+    {
+        ppu->frame_start = when - PPU_MODE3_START;
+        // Frames are skipped as a whole
+        ppu->skipping = ppu->skip_frame;
+    }
+
+    if (line + 1 < GB_LCD_HEIGHT)
+        sched_add(gb, SCHED_PPU_LINE, when + PPU_DOTS_PER_LINE);
+    else
+        sched_add(gb, SCHED_PPU_VBLANK, when - PPU_MODE3_START + PPU_DOTS_PER_LINE);
+
+    if (ppu->skipping)
+        return;
+
+    if (ppu->worker)
+        ppu_worker_log(ppu->worker, PPU_LOG_LINE, PPU_MODE3_START + line * PPU_DOTS_PER_LINE, 0, line);
+    else
+        ppu_render_begin_line(&ppu->render, line);
+}
+
+/**
+ * @brief Start of the vertical blanking period
+ *
+ * @param gb gameboy state struct
+ * @param when T-cycle timestamp the event was scheduled for
+ */
+void ppu_vblank_event(struct gb_s *gb, uint64_t when)
+{
+    struct ppu_s *ppu = &gb->ppu;
+
+    if (!ppu->skipping)
+    {
+        if (ppu->worker)
+            ppu_worker_vblank(ppu->worker);
+        else
+            ppu_render_end_line(&ppu->render);
+
+        ppu->frame_ready = true;
+    }
+
+    cpu_raise_interrupt(gb, IR_VBLANK);
+
+    sched_add(gb, SCHED_PPU_LINE, when + (PPU_LINES_PER_FRAME - GB_LCD_HEIGHT) * PPU_DOTS_PER_LINE + PPU_MODE3_START);
+}
+
+/**
+ * @brief Rising edge of the STAT interrupt line
+ *
+ * @param gb gameboy state struct
+ * @param when T-cycle timestamp the event was scheduled for
+ */
+void ppu_stat_event(struct gb_s *gb, uint64_t when)
+{
+    cpu_raise_interrupt(gb, IR_LCD);
+    ppu_schedule_stat(gb, when);
+}
+
+/**
+ * @brief Returns the last completed frame
+ *
+ * With the render worker, this is the frame before the one that just
+ * ended.
+ *
+ * @param gb gameboy state struct
+ * @return const uint8_t* 160x144 shades (0-3), see video_convert()
+ */
+const uint8_t *ppu_framebuffer(struct gb_s *gb)
+{
+    if (gb->ppu.worker)
+        return ppu_worker_framebuffer(gb);
+
+    return gb->ppu.framebuffer;
+}
+
+/**
+ * @brief Returns when the current frame ends
+ *
+ * @param gb gameboy state struct
+ * @return uint64_t T-cycle timestamp of the next VBlank, SCHED_NEVER with the LCD off
+ */
+uint64_t ppu_next_vblank(struct gb_s *gb)
+{
+    if (!(ppu_reg(gb, GB_LCDC) & LCDC_LCD_ENABLE))
+        return SCHED_NEVER;
+
+    uint64_t vblank = gb->ppu.frame_start + GB_LCD_HEIGHT * PPU_DOTS_PER_LINE;
+
+    while (vblank <= gb->clock)
+        vblank += PPU_DOTS_PER_FRAME;
+
+    return vblank;
+}
+
+/**
+ * @brief Returns when the next HBlank starts
+ *
+ * @param gb gameboy state struct
+ * @return uint64_t T-cycle timestamp of the next mode 0 start, SCHED_NEVER with the LCD off
+ */
+uint64_t ppu_next_hblank(struct gb_s *gb)
+{
+    if (!(ppu_reg(gb, GB_LCDC) & LCDC_LCD_ENABLE))
+        return SCHED_NEVER;
+
+    uint32_t dot = ppu_frame_dot(gb);
+    uint32_t line = dot / PPU_DOTS_PER_LINE;
+
+    if (line < GB_LCD_HEIGHT && dot % PPU_DOTS_PER_LINE < PPU_MODE0_START)
+        return gb->clock + PPU_MODE0_START - dot % PPU_DOTS_PER_LINE;
+    if (line + 1 < GB_LCD_HEIGHT)
+        return gb->clock + PPU_DOTS_PER_LINE - dot % PPU_DOTS_PER_LINE + PPU_MODE0_START;
+
+    // Line 0 of the next frame
+    return gb->clock + PPU_DOTS_PER_FRAME - dot + PPU_MODE0_START;
+}
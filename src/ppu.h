@@ -0,0 +1,203 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Constants */
+#define GB_LCD_WIDTH 160
+#define GB_LCD_HEIGHT 144
+#define GB_OAM_START 0xFE00
+#define GB_OAM_END 0xFEA0
+#define PPU_NUM_OBJS 40
+#define PPU_MAX_OBJS_PER_LINE 10
+#define PPU_DOTS_PER_LINE 456
+#define PPU_LINES_PER_FRAME 154
+#define PPU_DOTS_PER_FRAME (PPU_DOTS_PER_LINE * PPU_LINES_PER_FRAME)
+#define PPU_MODE3_START 80
+#define PPU_MODE0_START 252
+
+/* PPU modes as reported in STAT */
+#define PPU_MODE_HBLANK 0
+#define PPU_MODE_VBLANK 1
+#define PPU_MODE_OAM 2
+#define PPU_MODE_DRAW 3
+
+/* STAT bits */
+#define STAT_MODE_MASK 0x03 // Current PPU mode
+#define STAT_LYC_EQUAL (1 << 2)
+#define STAT_MODE0_INT (1 << 3)
+#define STAT_MODE1_INT (1 << 4)
+#define STAT_MODE2_INT (1 << 5)
+#define STAT_LYC_INT (1 << 6)
+#define STAT_INT_MASK (STAT_MODE0_INT | STAT_MODE1_INT | STAT_MODE2_INT | STAT_LYC_INT)
+
+/* LCDC bits */
+#define LCDC_BG_ENABLE (1 << 0)
+#define LCDC_OBJ_ENABLE (1 << 1)
+#define LCDC_OBJ_SIZE (1 << 2)
+#define LCDC_BG_MAP (1 << 3)
+#define LCDC_TILE_DATA (1 << 4)
+#define LCDC_WIN_ENABLE (1 << 5)
+#define LCDC_WIN_MAP (1 << 6)
+#define LCDC_LCD_ENABLE (1 << 7)
+
+/* OAM attribute bits */
+#define OBJ_PALETTE (1 << 4)
+#define OBJ_XFLIP (1 << 5)
+#define OBJ_YFLIP (1 << 6)
+#define OBJ_BG_PRIORITY (1 << 7)
+
+/* Line renderers */
+typedef enum ppu_renderer
+{
+    PPU_RENDERER_SCANLINE, // Renders a whole line at the start of mode 3
+    PPU_RENDERER_FIFO      // Pixel FIFO, picks up mid-line register writes
+} ppu_renderer_t;
+
+#ifdef PPU_FIFO
+/* Pixel FIFO state of the current line */
+struct ppu_fifo_s
+{
+    uint16_t dot;           // Dot up to which the line has been processed
+    int16_t lx;             // Next output x, negative while discarding pixels
+    uint8_t bg_lo;          // Background FIFO, low bit plane
+    uint8_t bg_hi;          // Background FIFO, high bit plane
+    uint8_t bg_len;         // Pixels left in the background FIFO
+    uint8_t obj_color[8];   // Object FIFO color indices, slot 0 is output next
+    uint8_t obj_attr[8];    // Object FIFO attributes
+    uint8_t fetch_step;     // Dots spent in the current tile fetch
+    uint8_t fetch_x;        // Tile column of the current fetch
+    uint8_t fetch_tile;     // Fetched tile index
+    uint8_t fetch_lo;       // Fetched tile data, low bit plane
+    uint8_t fetch_hi;       // Fetched tile data, high bit plane
+    bool window;            // Fetching window tiles instead of background
+    uint8_t win_y;          // Window line of the current line
+    uint8_t obj_next;       // Next bucket entry to fetch
+    uint8_t obj_stall;      // Dots left until a pending object fetch completes
+};
+#endif
+
+/* Renderer state
+ *
+ * Everything the line renderers read and write. It is either driven
+ * directly from the emulation (memory pointers into gb->memory) or owned
+ * by the render worker, which keeps its own copy of VRAM, OAM and the
+ * LCD registers.
+ */
+struct ppu_render_s
+{
+    uint8_t *vram;         // 0x8000 - 0x9FFF
+    uint8_t *oam;          // 0xFE00 - 0xFE9F
+    uint8_t *regs;         // 0xFF40 - 0xFF4B
+    uint8_t *framebuffer;  // Frame being rendered, one shade (0-3) per pixel
+
+    uint8_t ly;           // Line currently being rendered
+    uint8_t window_line;  // Internal window line counter
+    bool line_started;    // Mode 3 of the current line has been entered
+
+    // Per-line object buckets, kept up to date on OAM writes.
+    // obj_mask holds one bit per OAM entry covering the line, obj_line
+    // the (at most 10) selected entries in drawing priority order.
+    uint64_t obj_mask[GB_LCD_HEIGHT];
+    uint8_t obj_line[GB_LCD_HEIGHT][PPU_MAX_OBJS_PER_LINE];
+    uint8_t obj_count[GB_LCD_HEIGHT];
+    bool obj_dirty[GB_LCD_HEIGHT];
+
+#ifdef PPU_FIFO
+    ppu_renderer_t renderer;
+    struct ppu_fifo_s fifo;
+#endif
+};
+
+struct ppu_worker_s;
+
+/* Entries of the render worker log */
+typedef enum ppu_log_type
+{
+    PPU_LOG_WRITE, // Write to VRAM, OAM or an LCD register
+    PPU_LOG_LINE,  // Mode 3 start of a line
+    PPU_LOG_VBLANK // End of the visible frame
+} ppu_log_type_t;
+
+/* PPU state */
+struct ppu_s
+{
+    uint64_t frame_start; // T-cycle timestamp of line 0, dot 0 of the current frame
+    bool frame_ready;     // Set when a full frame was rendered
+    bool skip_frame;      // Don't render frames starting with the next one, set by the frontend
+    bool skipping;        // The current frame is not rendered
+
+    struct ppu_render_s render;
+    struct ppu_worker_s *worker; // Render worker, NULL when rendering synchronously
+
+    uint8_t framebuffer[GB_LCD_WIDTH * GB_LCD_HEIGHT];
+};
+
+static inline uint8_t ppu_render_reg(const struct ppu_render_s *r, uint16_t reg)
+{
+    return r->regs[reg - 0xFF40];
+}
+
+/* Frames only store the shade of each pixel, converting them to host
+ * pixels is left to the consumer (see video.h) */
+static inline uint8_t ppu_shade(uint8_t palette, uint8_t color)
+{
+    return (palette >> (color * 2)) & 0b11;
+}
+
+static inline uint16_t ppu_bg_tile_addr(uint8_t lcdc, uint8_t tile)
+{
+    if (lcdc & LCDC_TILE_DATA)
+        return 0x8000 + tile * 16;
+
+    return 0x9000 + (int8_t)tile * 16;
+}
+
+/**
+ * @brief Checks whether a write to this address is visible to the renderer
+ *
+ * @param loc 16-bit memory address
+ * @return true for VRAM, OAM and the LCD registers
+ */
+static inline bool ppu_is_video_addr(uint16_t loc)
+{
+    return (loc >= 0x8000 && loc < 0xA000) ||
+           (loc >= GB_OAM_START && loc < GB_OAM_END) ||
+           (loc >= 0xFF40 && loc <= 0xFF4B);
+}
+
+struct gb_s;
+
+void ppu_init(struct gb_s *gb);
+void ppu_write(struct gb_s *gb, uint16_t loc, uint8_t data);
+void ppu_oam_dma(struct gb_s *gb, const uint8_t *data);
+void ppu_vram_dma(struct gb_s *gb, uint16_t loc, const uint8_t *data, uint16_t len);
+void ppu_line_event(struct gb_s *gb, uint64_t when);
+void ppu_vblank_event(struct gb_s *gb, uint64_t when);
+void ppu_stat_event(struct gb_s *gb, uint64_t when);
+uint8_t ppu_read_ly(struct gb_s *gb);
+uint8_t ppu_read_stat(struct gb_s *gb);
+const uint8_t *ppu_framebuffer(struct gb_s *gb);
+uint64_t ppu_next_vblank(struct gb_s *gb);
+uint64_t ppu_next_hblank(struct gb_s *gb);
+int ppu_set_renderer(struct gb_s *gb, ppu_renderer_t renderer);
+
+void ppu_render_init(struct ppu_render_s *r);
+void ppu_render_write(struct ppu_render_s *r, uint16_t loc, uint8_t data, uint32_t frame_dot);
+void ppu_render_begin_line(struct ppu_render_s *r, uint8_t line);
+void ppu_render_end_line(struct ppu_render_s *r);
+void ppu_render_oam_refresh(struct ppu_render_s *r);
+void ppu_render_oam_dma(struct ppu_render_s *r, const uint8_t *data, uint32_t frame_dot);
+void ppu_render_vram_dma(struct ppu_render_s *r, uint16_t loc, const uint8_t *data, uint16_t len, uint32_t frame_dot);
+
+#ifdef PPU_FIFO
+void ppu_fifo_begin_line(struct ppu_render_s *r);
+void ppu_fifo_run(struct ppu_render_s *r, uint16_t target_dot);
+#endif
+
+int ppu_worker_start(struct gb_s *gb);
+void ppu_worker_stop(struct gb_s *gb);
+void ppu_worker_log(struct ppu_worker_s *w, ppu_log_type_t type, uint32_t frame_dot, uint16_t loc, uint8_t data);
+void ppu_worker_vblank(struct ppu_worker_s *w);
+void ppu_worker_sync(struct gb_s *gb);
+const uint8_t *ppu_worker_framebuffer(struct gb_s *gb);
@@ -0,0 +1,284 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include "gb.h"
+#include "ppu.h"
+
+/*
+ * Pixel FIFO renderer
+ *
+ * Emulates the background fetcher and the pixel FIFOs dot by dot, so
+ * SCX/SCY, LCDC and palette writes during mode 3 affect the pixels
+ * output after them. The FIFO is only advanced lazily: it is caught up
+ * before each write to something the renderer reads, and the rest of
+ * the line is processed when it ends.
+ *
+ * see https://gbdev.io/pandocs/pixel_fifo.html
+ */
+
+#define FIFO_FETCH_PUSH 6 // Fetch step at which the tile is pushed
+#define FIFO_OBJ_STALL 6  // Dots an object fetch pauses the output
+
+static inline uint8_t fifo_vram(struct ppu_render_s *r, uint16_t loc)
+{
+    return r->vram[loc - 0x8000];
+}
+
+static void fifo_start_window(struct ppu_render_s *r)
+{
+    struct ppu_fifo_s *fifo = &r->fifo;
+
+    fifo->window = true;
+    fifo->win_y = r->window_line++;
+    fifo->bg_len = 0;
+    fifo->fetch_step = 0;
+    fifo->fetch_x = 0;
+}
+
+/**
+ * @brief Advances the background fetcher by one dot
+ *
+ * Each step takes two dots; the tile is pushed as soon as the
+ * background FIFO has run empty.
+ *
+ * @param r renderer state
+ * @param line line being rendered
+ */
+static void fifo_fetch_step(struct ppu_render_s *r, uint8_t line)
+{
+    struct ppu_fifo_s *fifo = &r->fifo;
+    uint8_t lcdc = ppu_render_reg(r, GB_LCDC);
+    uint8_t y = fifo->window ? fifo->win_y : (uint8_t)(line + ppu_render_reg(r, GB_SCY));
+
+    switch (fifo->fetch_step)
+    {
+    case 1:
+    {
+        uint16_t map;
+        uint8_t x;
+
+        if (fifo->window)
+        {
+            map = (lcdc & LCDC_WIN_MAP) ? 0x9C00 : 0x9800;
+            x = fifo->fetch_x;
+        }
+        else
+        {
+            map = (lcdc & LCDC_BG_MAP) ? 0x9C00 : 0x9800;
+            x = (ppu_render_reg(r, GB_SCX) / 8 + fifo->fetch_x) & 31;
+        }
+
+        fifo->fetch_tile = fifo_vram(r, map + (y / 8) * 32 + x);
+        break;
+    }
+
+    case 3:
+        fifo->fetch_lo = fifo_vram(r, ppu_bg_tile_addr(lcdc, fifo->fetch_tile) + (y % 8) * 2);
+        break;
+
+    case 5:
+        fifo->fetch_hi = fifo_vram(r, ppu_bg_tile_addr(lcdc, fifo->fetch_tile) + (y % 8) * 2 + 1);
+        break;
+
+    case FIFO_FETCH_PUSH:
+        if (fifo->bg_len != 0)
+            return;
+
+        fifo->bg_lo = fifo->fetch_lo;
+        fifo->bg_hi = fifo->fetch_hi;
+        fifo->bg_len = 8;
+        fifo->fetch_x++;
+        fifo->fetch_step = 0;
+        return;
+    }
+
+    fifo->fetch_step++;
+}
+
+/**
+ * @brief Merges an object into the object FIFO
+ *
+ * Objects are fetched in drawing priority order, so pixels already
+ * occupied by an opaque object pixel are kept.
+ *
+ * @param r renderer state
+ * @param line line being rendered
+ * @param index OAM entry index
+ */
+static void fifo_fetch_obj(struct ppu_render_s *r, uint8_t line, uint8_t index)
+{
+    struct ppu_fifo_s *fifo = &r->fifo;
+    const uint8_t *obj = &r->oam[index * 4];
+    uint8_t height = (ppu_render_reg(r, GB_LCDC) & LCDC_OBJ_SIZE) ? 16 : 8;
+    uint8_t row = line - (obj[0] - 16);
+    uint8_t tile = obj[2];
+    uint8_t attr = obj[3];
+
+    if (attr & OBJ_YFLIP)
+        row = height - 1 - row;
+    if (height == 16)
+        tile &= 0xFE;
+
+    uint8_t lo = fifo_vram(r, 0x8000 + tile * 16 + row * 2);
+    uint8_t hi = fifo_vram(r, 0x8000 + tile * 16 + row * 2 + 1);
+
+    for (int col = 0; col < 8; col++)
+    {
+        // OAM may have been written since the object was selected
+        int slot = obj[1] - 8 + col - fifo->lx;
+        if (slot < 0 || slot >= 8 || fifo->obj_color[slot] != 0)
+            continue;
+
+        uint8_t bit = (attr & OBJ_XFLIP) ? col : 7 - col;
+        fifo->obj_color[slot] = ((lo >> bit) & 1) | (((hi >> bit) & 1) << 1);
+        fifo->obj_attr[slot] = attr;
+    }
+}
+
+/**
+ * @brief Checks whether the next bucket object starts at the output position
+ *
+ * Starts the object fetch stall if so. Objects hanging off the left
+ * edge start at x = 0.
+ *
+ * @param r renderer state
+ * @param line line being rendered
+ * @return true if an object fetch is pending
+ */
+static bool fifo_check_obj(struct ppu_render_s *r, uint8_t line)
+{
+    struct ppu_fifo_s *fifo = &r->fifo;
+
+    while (fifo->obj_next < r->obj_count[line])
+    {
+        const uint8_t *obj = &r->oam[r->obj_line[line][fifo->obj_next] * 4];
+        int obj_x = obj[1] - 8;
+
+        if (obj_x > fifo->lx)
+            return false;
+
+        if (obj_x + 8 <= fifo->lx || !(ppu_render_reg(r, GB_LCDC) & LCDC_OBJ_ENABLE))
+        {
+            // Entirely off-screen or objects disabled at fetch time
+            fifo->obj_next++;
+            continue;
+        }
+
+        fifo->obj_stall = FIFO_OBJ_STALL;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Shifts one pixel out of the FIFOs and mixes it
+ *
+ * Palettes and the background enable bit are applied at output time.
+ *
+ * @param r renderer state
+ * @param line line being rendered
+ */
+static void fifo_output_pixel(struct ppu_render_s *r, uint8_t line)
+{
+    struct ppu_fifo_s *fifo = &r->fifo;
+    uint8_t bg = ((fifo->bg_lo >> 7) & 1) | (((fifo->bg_hi >> 7) & 1) << 1);
+
+    fifo->bg_lo <<= 1;
+    fifo->bg_hi <<= 1;
+    fifo->bg_len--;
+
+    if (fifo->lx < 0)
+    {
+        // Fine scroll discard
+        fifo->lx++;
+        return;
+    }
+
+    uint8_t obj = fifo->obj_color[0];
+    uint8_t attr = fifo->obj_attr[0];
+
+    memmove(&fifo->obj_color[0], &fifo->obj_color[1], 7);
+    memmove(&fifo->obj_attr[0], &fifo->obj_attr[1], 7);
+    fifo->obj_color[7] = 0;
+
+    if (!(ppu_render_reg(r, GB_LCDC) & LCDC_BG_ENABLE))
+        bg = 0;
+
+    uint8_t pixel;
+    if (obj != 0 && !((attr & OBJ_BG_PRIORITY) && bg != 0))
+        pixel = ppu_shade(ppu_render_reg(r, (attr & OBJ_PALETTE) ? GB_OBP1 : GB_OBP0), obj);
+    else
+        pixel = ppu_shade(ppu_render_reg(r, GB_BGP), bg);
+
+    r->framebuffer[line * GB_LCD_WIDTH + fifo->lx] = pixel;
+    fifo->lx++;
+}
+
+/**
+ * @brief Sets up the FIFO at the start of mode 3
+ *
+ * @param r renderer state
+ */
+void ppu_fifo_begin_line(struct ppu_render_s *r)
+{
+    struct ppu_fifo_s *fifo = &r->fifo;
+    uint8_t lcdc = ppu_render_reg(r, GB_LCDC);
+    int win_x = ppu_render_reg(r, GB_WX) - 7;
+
+    memset(fifo, 0, sizeof(*fifo));
+    fifo->dot = PPU_MODE3_START;
+    fifo->lx = -(ppu_render_reg(r, GB_SCX) % 8);
+
+    if (win_x <= 0 && (lcdc & LCDC_WIN_ENABLE) && (lcdc & LCDC_BG_ENABLE) && ppu_render_reg(r, GB_WY) <= r->ly)
+    {
+        // Window starts at the left edge, its first pixels are cut off instead
+        fifo_start_window(r);
+        fifo->lx = win_x;
+    }
+}
+
+/**
+ * @brief Runs the pixel FIFO up to the given dot of the current line
+ *
+ * @param r renderer state
+ * @param target_dot dot to run to (exclusive)
+ */
+void ppu_fifo_run(struct ppu_render_s *r, uint16_t target_dot)
+{
+    struct ppu_fifo_s *fifo = &r->fifo;
+    uint8_t line = r->ly;
+
+    while (fifo->dot < target_dot && fifo->lx < GB_LCD_WIDTH)
+    {
+        fifo->dot++;
+
+        if (fifo->obj_stall)
+        {
+            if (--fifo->obj_stall == 0)
+                fifo_fetch_obj(r, line, r->obj_line[line][fifo->obj_next++]);
+
+            continue;
+        }
+
+        if (fifo->lx >= 0)
+        {
+            uint8_t lcdc = ppu_render_reg(r, GB_LCDC);
+
+            if (!fifo->window && fifo->lx == ppu_render_reg(r, GB_WX) - 7 && (lcdc & LCDC_WIN_ENABLE) &&
+                (lcdc & LCDC_BG_ENABLE) && ppu_render_reg(r, GB_WY) <= line)
+            {
+                fifo_start_window(r);
+            }
+
+            if (fifo_check_obj(r, line))
+                continue;
+        }
+
+        if (fifo->bg_len)
+            fifo_output_pixel(r, line);
+
+        fifo_fetch_step(r, line);
+    }
+}
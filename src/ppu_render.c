@@ -0,0 +1,436 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include "gb.h"
+#include "ppu.h"
+
+/*
+ * Line renderers
+ *
+ * Only work on a struct ppu_render_s, so the same code runs on the
+ * emulation thread or on the render worker.
+ */
+
+static inline uint8_t ppu_obj_height(const struct ppu_render_s *r)
+{
+    return (ppu_render_reg(r, GB_LCDC) & LCDC_OBJ_SIZE) ? 16 : 8;
+}
+
+/**
+ * @brief Adds or removes an object from the buckets of all lines it covers
+ *
+ * Marks the affected lines dirty, so their selection is rebuilt before
+ * they are rendered next.
+ *
+ * @param r renderer state
+ * @param index OAM entry index (0-39)
+ * @param y OAM Y position of the object
+ * @param set true to add the object, false to remove it
+ */
+static void ppu_obj_update_lines(struct ppu_render_s *r, uint8_t index, uint8_t y, bool set)
+{
+    int top = y - 16;
+    int bottom = top + ppu_obj_height(r);
+
+    if (top < 0)
+        top = 0;
+    if (bottom > GB_LCD_HEIGHT)
+        bottom = GB_LCD_HEIGHT;
+
+    for (int line = top; line < bottom; line++)
+    {
+        if (set)
+            r->obj_mask[line] |= (uint64_t)1 << index;
+        else
+            r->obj_mask[line] &= ~((uint64_t)1 << index);
+
+        r->obj_dirty[line] = true;
+    }
+}
+
+/**
+ * @brief Rebuilds the object selection of a single line
+ *
+ * Picks the first 10 objects in OAM order that cover the line and sorts
+ * them by drawing priority: on DMG, the lower X coordinate wins and ties
+ * are resolved by the lower OAM index.
+ *
+ * @param r renderer state
+ * @param line line to rebuild
+ */
+static void ppu_obj_select_line(struct ppu_render_s *r, uint8_t line)
+{
+    const uint8_t *oam = r->oam;
+    uint64_t mask = r->obj_mask[line];
+    uint8_t count = 0;
+
+    while (mask && count < PPU_MAX_OBJS_PER_LINE)
+    {
+        uint8_t index = __builtin_ctzll(mask);
+        mask &= mask - 1;
+
+        // Insertion sort, OAM order is kept for equal X coordinates
+        uint8_t x = oam[index * 4 + 1];
+        uint8_t pos = count;
+        while (pos > 0 && oam[r->obj_line[line][pos - 1] * 4 + 1] > x)
+        {
+            r->obj_line[line][pos] = r->obj_line[line][pos - 1];
+            pos--;
+        }
+        r->obj_line[line][pos] = index;
+        count++;
+    }
+
+    r->obj_count[line] = count;
+    r->obj_dirty[line] = false;
+}
+
+/**
+ * @brief Write byte to OAM and update the object buckets
+ *
+ * Y writes move the object between line buckets, X writes only
+ * change the order within the lines the object already covers.
+ *
+ * @param r renderer state
+ * @param loc 16-bit OAM address to write to
+ * @param data byte to write
+ */
+static void ppu_oam_write(struct ppu_render_s *r, uint16_t loc, uint8_t data)
+{
+    uint8_t *oam = r->oam;
+    uint8_t offset = loc - GB_OAM_START;
+    uint8_t index = offset / 4;
+
+    switch (offset % 4)
+    {
+    case 0:
+        // Y coordinate
+        ppu_obj_update_lines(r, index, oam[offset], false);
+        oam[offset] = data;
+        ppu_obj_update_lines(r, index, data, true);
+        break;
+
+    case 1:
+        // X coordinate
+        oam[offset] = data;
+        ppu_obj_update_lines(r, index, oam[offset - 1], true);
+        break;
+
+    default:
+        // Tile index and attributes don't affect selection
+        oam[offset] = data;
+        break;
+    }
+}
+
+/**
+ * @brief Rebuilds all object buckets from OAM
+ *
+ * Bulk path for changes that affect every line at once (e.g. object
+ * size switches or whole-OAM transfers).
+ *
+ * @param r renderer state
+ */
+void ppu_render_oam_refresh(struct ppu_render_s *r)
+{
+    memset(r->obj_mask, 0, sizeof(r->obj_mask));
+
+    for (uint8_t index = 0; index < PPU_NUM_OBJS; index++)
+    {
+        ppu_obj_update_lines(r, index, r->oam[index * 4], true);
+    }
+
+    memset(r->obj_dirty, true, sizeof(r->obj_dirty));
+}
+
+/**
+ * @brief Fetches the color index of a tile pixel
+ *
+ * @param r renderer state
+ * @param tile_addr 16-bit address of the tile data
+ * @param row tile row (0-15 for 8x16 objects)
+ * @param col tile column (0-7, 0 is the leftmost pixel)
+ * @return uint8_t color index (0-3)
+ */
+static inline uint8_t ppu_tile_pixel(const struct ppu_render_s *r, uint16_t tile_addr, uint8_t row, uint8_t col)
+{
+    uint8_t lo = r->vram[tile_addr + row * 2 - 0x8000];
+    uint8_t hi = r->vram[tile_addr + row * 2 + 1 - 0x8000];
+    uint8_t bit = 7 - col;
+
+    return ((lo >> bit) & 1) | (((hi >> bit) & 1) << 1);
+}
+
+/**
+ * @brief Renders the background and window of a line
+ *
+ * @param r renderer state
+ * @param line line to render
+ * @param bg_index output buffer of background color indices (before palette)
+ */
+static void ppu_render_bg_line(struct ppu_render_s *r, uint8_t line, uint8_t *bg_index)
+{
+    uint8_t lcdc = ppu_render_reg(r, GB_LCDC);
+
+    if (!(lcdc & LCDC_BG_ENABLE))
+    {
+        // On DMG, this bit disables background and window
+        memset(bg_index, 0, GB_LCD_WIDTH);
+        return;
+    }
+
+    uint8_t scx = ppu_render_reg(r, GB_SCX);
+    uint8_t scy = ppu_render_reg(r, GB_SCY);
+    uint8_t wy = ppu_render_reg(r, GB_WY);
+    int win_x = ppu_render_reg(r, GB_WX) - 7;
+    bool window = (lcdc & LCDC_WIN_ENABLE) && wy <= line && win_x < GB_LCD_WIDTH;
+    int bg_end = window ? (win_x < 0 ? 0 : win_x) : GB_LCD_WIDTH;
+
+    uint16_t map = (lcdc & LCDC_BG_MAP) ? 0x9C00 : 0x9800;
+    uint8_t y = line + scy;
+
+    for (int x = 0; x < bg_end; x++)
+    {
+        uint8_t px = x + scx;
+        uint8_t tile = r->vram[map + (y / 8) * 32 + px / 8 - 0x8000];
+        bg_index[x] = ppu_tile_pixel(r, ppu_bg_tile_addr(lcdc, tile), y % 8, px % 8);
+    }
+
+    if (!window)
+        return;
+
+    map = (lcdc & LCDC_WIN_MAP) ? 0x9C00 : 0x9800;
+    y = r->window_line++;
+
+    for (int x = bg_end; x < GB_LCD_WIDTH; x++)
+    {
+        uint8_t px = x - win_x;
+        uint8_t tile = r->vram[map + (y / 8) * 32 + px / 8 - 0x8000];
+        bg_index[x] = ppu_tile_pixel(r, ppu_bg_tile_addr(lcdc, tile), y % 8, px % 8);
+    }
+}
+
+/**
+ * @brief Renders a single line into the framebuffer
+ *
+ * Objects are taken from the prepared line bucket instead of
+ * scanning OAM.
+ *
+ * @param r renderer state
+ * @param line line to render
+ */
+static void ppu_render_line(struct ppu_render_s *r, uint8_t line)
+{
+    uint8_t lcdc = ppu_render_reg(r, GB_LCDC);
+    uint8_t bgp = ppu_render_reg(r, GB_BGP);
+    uint8_t *out = &r->framebuffer[line * GB_LCD_WIDTH];
+    uint8_t bg_index[GB_LCD_WIDTH];
+
+    ppu_render_bg_line(r, line, bg_index);
+
+    for (int x = 0; x < GB_LCD_WIDTH; x++)
+    {
+        out[x] = ppu_shade(bgp, bg_index[x]);
+    }
+
+    if (!(lcdc & LCDC_OBJ_ENABLE))
+        return;
+
+    uint8_t height = ppu_obj_height(r);
+    bool drawn[GB_LCD_WIDTH] = {false};
+
+    // Bucket is sorted by priority, so the first opaque pixel wins
+    for (uint8_t i = 0; i < r->obj_count[line]; i++)
+    {
+        const uint8_t *obj = &r->oam[r->obj_line[line][i] * 4];
+        int obj_x = obj[1] - 8;
+        uint8_t attr = obj[3];
+        uint8_t row = line - (obj[0] - 16);
+        uint8_t tile = obj[2];
+        uint8_t obp = ppu_render_reg(r, (attr & OBJ_PALETTE) ? GB_OBP1 : GB_OBP0);
+
+        if (attr & OBJ_YFLIP)
+            row = height - 1 - row;
+        if (height == 16)
+            tile &= 0xFE;
+
+        for (int col = 0; col < 8; col++)
+        {
+            int x = obj_x + col;
+            if (x < 0 || x >= GB_LCD_WIDTH || drawn[x])
+                continue;
+
+            uint8_t color = ppu_tile_pixel(r, 0x8000 + tile * 16, row, (attr & OBJ_XFLIP) ? 7 - col : col);
+            if (color == 0)
+                continue;
+
+            drawn[x] = true;
+            if ((attr & OBJ_BG_PRIORITY) && bg_index[x] != 0)
+                continue;
+
+            out[x] = ppu_shade(obp, color);
+        }
+    }
+}
+
+void ppu_render_init(struct ppu_render_s *r)
+{
+    r->ly = 0;
+    r->window_line = 0;
+    r->line_started = false;
+    ppu_render_oam_refresh(r);
+
+#ifdef PPU_FIFO
+    r->renderer = PPU_RENDERER_FIFO;
+#endif
+}
+
+/**
+ * @brief Catches the pixel FIFO up with the time of a write
+ *
+ * @param r renderer state
+ * @param frame_dot dot within the frame the write happened at
+ */
+static inline void ppu_render_catch_up(struct ppu_render_s *r, uint32_t frame_dot)
+{
+#ifdef PPU_FIFO
+    if (r->renderer == PPU_RENDERER_FIFO && r->line_started)
+    {
+        if (frame_dot / PPU_DOTS_PER_LINE == r->ly)
+            ppu_fifo_run(r, frame_dot % PPU_DOTS_PER_LINE);
+        else
+            ppu_fifo_run(r, PPU_DOTS_PER_LINE);
+    }
+#else
+    (void)r;
+    (void)frame_dot;
+#endif
+}
+
+/**
+ * @brief Applies a write to VRAM, OAM or an LCD register
+ *
+ * The pixel FIFO is caught up with the time of the write first.
+ *
+ * @param r renderer state
+ * @param loc 16-bit address to write to
+ * @param data byte to write
+ * @param frame_dot dot within the frame the write happened at
+ */
+void ppu_render_write(struct ppu_render_s *r, uint16_t loc, uint8_t data, uint32_t frame_dot)
+{
+    ppu_render_catch_up(r, frame_dot);
+
+    if (loc < 0xA000)
+    {
+        r->vram[loc - 0x8000] = data;
+    }
+    else if (loc < GB_OAM_END)
+    {
+        ppu_oam_write(r, loc, data);
+    }
+    else if (loc == GB_LCDC)
+    {
+        uint8_t old = r->regs[0];
+        r->regs[0] = data;
+
+        if ((old ^ data) & LCDC_OBJ_SIZE)
+        {
+            // Object height changed, every bucket may be affected
+            ppu_render_oam_refresh(r);
+        }
+
+        if (!(data & LCDC_LCD_ENABLE))
+            r->line_started = false;
+    }
+    else
+    {
+        r->regs[loc - 0xFF40] = data;
+    }
+}
+
+/**
+ * @brief Replaces OAM with the bytes of an OAM DMA transfer
+ *
+ * The object buckets are rebuilt once instead of per byte, and not at
+ * all if nothing changed.
+ *
+ * @param r renderer state
+ * @param data GB_OAM_END - GB_OAM_START bytes
+ * @param frame_dot dot within the frame the transfer started at
+ */
+void ppu_render_oam_dma(struct ppu_render_s *r, const uint8_t *data, uint32_t frame_dot)
+{
+    if (memcmp(r->oam, data, GB_OAM_END - GB_OAM_START) == 0)
+        return;
+
+    ppu_render_catch_up(r, frame_dot);
+
+    memcpy(r->oam, data, GB_OAM_END - GB_OAM_START);
+    ppu_render_oam_refresh(r);
+}
+
+/**
+ * @brief Writes a block of VRAM copied by DMA
+ *
+ * @param r renderer state
+ * @param loc 16-bit VRAM address of the first byte
+ * @param data bytes to write
+ * @param len number of bytes
+ * @param frame_dot dot within the frame the block was copied at
+ */
+void ppu_render_vram_dma(struct ppu_render_s *r, uint16_t loc, const uint8_t *data, uint16_t len, uint32_t frame_dot)
+{
+    ppu_render_catch_up(r, frame_dot);
+
+    memcpy(&r->vram[loc - 0x8000], data, len);
+}
+
+/**
+ * @brief Finishes the line currently being rendered
+ *
+ * @param r renderer state
+ */
+void ppu_render_end_line(struct ppu_render_s *r)
+{
+#ifdef PPU_FIFO
+    if (r->line_started && r->renderer == PPU_RENDERER_FIFO)
+        ppu_fifo_run(r, PPU_DOTS_PER_LINE);
+#endif
+
+    r->line_started = false;
+}
+
+/**
+ * @brief Enters mode 3 of a line
+ *
+ * The scanline renderer draws the whole line right away, so register
+ * writes during mode 3 only show up on the next line.
+ *
+ * @param r renderer state
+ * @param line line to start
+ */
+void ppu_render_begin_line(struct ppu_render_s *r, uint8_t line)
+{
+    ppu_render_end_line(r);
+
+    if (line == 0)
+        r->window_line = 0;
+
+    if (r->obj_dirty[line])
+        ppu_obj_select_line(r, line);
+
+    r->ly = line;
+    r->line_started = true;
+
+#ifdef PPU_FIFO
+    if (r->renderer == PPU_RENDERER_FIFO)
+    {
+        ppu_fifo_begin_line(r);
+        return;
+    }
+#endif
+
+    ppu_render_line(r, line);
+}
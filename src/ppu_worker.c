@@ -0,0 +1,319 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gb.h"
+#include "ppu.h"
+
+/*
+ * Render worker
+ *
+ * Moves pixel generation off the emulation thread. The PPU timing stays
+ * on the emulation thread, which logs every write to VRAM, OAM and the
+ * LCD registers together with line start and frame end markers, in the
+ * order they happen. At the end of each visible frame the log is handed
+ * to the worker, which replays it against its own copy of the video
+ * memory. Since the replay runs the same renderer code in the same
+ * order, mid-frame (and with the pixel FIFO, mid-line) effects come out
+ * exactly as with synchronous rendering.
+ *
+ * The worker renders frame N while the emulation runs frame N+1, so
+ * completed frames are published one frame later.
+ */
+
+#define PPU_WORKER_LOG_SIZE 32768
+
+struct ppu_log_entry_s
+{
+    uint32_t dot;   // Dot within the frame
+    uint16_t loc;   // Address written to
+    uint8_t data;   // Byte written, line number for line markers
+    uint8_t type;   // ppu_log_type_t
+};
+
+struct ppu_worker_s
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool busy;       // A log has been handed over and is being replayed
+    bool quit;
+    bool frame_done; // The replayed log completed a frame
+
+    struct ppu_log_entry_s *log[2];
+    uint32_t log_len[2];
+    int fill;   // Log the emulation thread appends to
+    int replay; // Log the worker replays
+
+    int back;  // Framebuffer being rendered into
+    int front; // Last completed frame
+
+    // Worker copy of the video memory
+    struct ppu_render_s render;
+    uint8_t vram[0x2000];
+    uint8_t oam[GB_OAM_END - GB_OAM_START];
+    uint8_t regs[0x0C];
+    uint8_t framebuffers[2][GB_LCD_WIDTH * GB_LCD_HEIGHT];
+};
+
+static void *ppu_worker_main(void *arg)
+{
+    struct ppu_worker_s *w = arg;
+
+    pthread_mutex_lock(&w->lock);
+
+    while (true)
+    {
+        while (!w->busy && !w->quit)
+            pthread_cond_wait(&w->cond, &w->lock);
+
+        if (!w->busy)
+            break;
+
+        const struct ppu_log_entry_s *log = w->log[w->replay];
+        uint32_t len = w->log_len[w->replay];
+        bool frame_done = false;
+        pthread_mutex_unlock(&w->lock);
+
+        for (uint32_t i = 0; i < len; i++)
+        {
+            switch (log[i].type)
+            {
+            case PPU_LOG_WRITE:
+                ppu_render_write(&w->render, log[i].loc, log[i].data, log[i].dot);
+                break;
+
+            case PPU_LOG_LINE:
+                ppu_render_begin_line(&w->render, log[i].data);
+                break;
+
+            case PPU_LOG_VBLANK:
+                ppu_render_end_line(&w->render);
+                frame_done = true;
+                break;
+            }
+        }
+
+        pthread_mutex_lock(&w->lock);
+        w->frame_done |= frame_done;
+        w->busy = false;
+        pthread_cond_broadcast(&w->cond);
+    }
+
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+/**
+ * @brief Waits until the worker has replayed everything handed to it
+ *
+ * Publishes a completed frame. Must be called with the lock held.
+ *
+ * @param w render worker
+ */
+static void ppu_worker_wait_idle(struct ppu_worker_s *w)
+{
+    while (w->busy)
+        pthread_cond_wait(&w->cond, &w->lock);
+
+    if (w->frame_done)
+    {
+        w->front = w->back;
+        w->back ^= 1;
+        w->render.framebuffer = w->framebuffers[w->back];
+        w->frame_done = false;
+
+        // Lines not drawn again keep the last frame, like the single synchronous buffer
+        memcpy(w->framebuffers[w->back], w->framebuffers[w->front], sizeof(w->framebuffers[0]));
+    }
+}
+
+/**
+ * @brief Hands the current log to the worker
+ *
+ * Blocks only if the worker is still busy with the previous one.
+ *
+ * @param w render worker
+ */
+static void ppu_worker_submit(struct ppu_worker_s *w)
+{
+    pthread_mutex_lock(&w->lock);
+    ppu_worker_wait_idle(w);
+
+    w->replay = w->fill;
+    w->fill ^= 1;
+    w->log_len[w->fill] = 0;
+    w->busy = true;
+
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+/**
+ * @brief Appends an entry to the render log
+ *
+ * @param w render worker
+ * @param type entry type
+ * @param frame_dot dot within the frame
+ * @param loc address written to
+ * @param data byte written, line number for line markers
+ */
+void ppu_worker_log(struct ppu_worker_s *w, ppu_log_type_t type, uint32_t frame_dot, uint16_t loc, uint8_t data)
+{
+    struct ppu_log_entry_s *entry = &w->log[w->fill][w->log_len[w->fill]++];
+
+    entry->dot = frame_dot;
+    entry->loc = loc;
+    entry->data = data;
+    entry->type = type;
+
+    if (w->log_len[w->fill] == PPU_WORKER_LOG_SIZE)
+    {
+        // Only happens with the LCD off or with huge amounts of VRAM writes
+        ppu_worker_submit(w);
+    }
+}
+
+/**
+ * @brief Ends the visible frame and hands it to the worker
+ *
+ * @param w render worker
+ */
+void ppu_worker_vblank(struct ppu_worker_s *w)
+{
+    ppu_worker_log(w, PPU_LOG_VBLANK, GB_LCD_HEIGHT * PPU_DOTS_PER_LINE, 0, 0);
+    ppu_worker_submit(w);
+}
+
+/**
+ * @brief Waits until everything logged so far is rendered
+ *
+ * The frame in progress is copied to the PPU framebuffer, which then
+ * holds exactly what synchronous rendering would have drawn so far.
+ *
+ * @param gb gameboy state struct
+ */
+void ppu_worker_sync(struct gb_s *gb)
+{
+    struct ppu_worker_s *w = gb->ppu.worker;
+
+    if (!w)
+        return;
+
+    ppu_worker_submit(w);
+
+    pthread_mutex_lock(&w->lock);
+    ppu_worker_wait_idle(w);
+    pthread_mutex_unlock(&w->lock);
+
+    memcpy(gb->ppu.framebuffer, w->framebuffers[w->back], sizeof(gb->ppu.framebuffer));
+}
+
+const uint8_t *ppu_worker_framebuffer(struct gb_s *gb)
+{
+    return gb->ppu.worker->framebuffers[gb->ppu.worker->front];
+}
+
+/**
+ * @brief Moves rendering to a worker thread
+ *
+ * The worker takes over the current renderer state, so this can be
+ * called at any point.
+ *
+ * @param gb gameboy state struct
+ * @return int 0 on success
+ */
+int ppu_worker_start(struct gb_s *gb)
+{
+    struct ppu_s *ppu = &gb->ppu;
+
+    if (ppu->worker)
+        return 0;
+
+    struct ppu_worker_s *w = calloc(1, sizeof(*w));
+    if (!w)
+        return -1;
+
+    w->log[0] = malloc(PPU_WORKER_LOG_SIZE * sizeof(struct ppu_log_entry_s));
+    w->log[1] = malloc(PPU_WORKER_LOG_SIZE * sizeof(struct ppu_log_entry_s));
+    if (!w->log[0] || !w->log[1])
+        goto fail;
+
+    memcpy(w->vram, ppu->render.vram, sizeof(w->vram));
+    memcpy(w->oam, ppu->render.oam, sizeof(w->oam));
+    memcpy(w->regs, ppu->render.regs, sizeof(w->regs));
+    memcpy(w->framebuffers[0], ppu->framebuffer, sizeof(ppu->framebuffer));
+    memcpy(w->framebuffers[1], ppu->framebuffer, sizeof(ppu->framebuffer));
+
+    w->render = ppu->render;
+    w->render.vram = w->vram;
+    w->render.oam = w->oam;
+    w->render.regs = w->regs;
+    w->render.framebuffer = w->framebuffers[0];
+    w->back = 0;
+    w->front = 1;
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+
+    if (pthread_create(&w->thread, NULL, ppu_worker_main, w) != 0)
+    {
+        printf("Could not start render worker\n");
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+        goto fail;
+    }
+
+    ppu->worker = w;
+    return 0;
+
+fail:
+    free(w->log[0]);
+    free(w->log[1]);
+    free(w);
+    return -1;
+}
+
+/**
+ * @brief Replays the remaining log and moves rendering back to the emulation thread
+ *
+ * @param gb gameboy state struct
+ */
+void ppu_worker_stop(struct gb_s *gb)
+{
+    struct ppu_s *ppu = &gb->ppu;
+    struct ppu_worker_s *w = ppu->worker;
+
+    if (!w)
+        return;
+
+    ppu_worker_submit(w);
+
+    pthread_mutex_lock(&w->lock);
+    ppu_worker_wait_idle(w);
+    w->quit = true;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+
+    // Video memory of the emulation is already up to date
+    uint8_t *vram = ppu->render.vram;
+    uint8_t *oam = ppu->render.oam;
+    uint8_t *regs = ppu->render.regs;
+
+    ppu->render = w->render;
+    ppu->render.vram = vram;
+    ppu->render.oam = oam;
+    ppu->render.regs = regs;
+    ppu->render.framebuffer = ppu->framebuffer;
+    memcpy(ppu->framebuffer, w->framebuffers[w->back], sizeof(ppu->framebuffer));
+
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+    free(w->log[0]);
+    free(w->log[1]);
+    free(w);
+    ppu->worker = NULL;
+}
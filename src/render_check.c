@@ -0,0 +1,169 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "gb.h"
+#include "apu.h"
+#include "ppu.h"
+#include "serial.h"
+
+/*
+ * Render worker check
+ *
+ * Runs a ROM twice in lockstep, once rendering synchronously and once
+ * on the render worker, and compares the framebuffers after every
+ * slice. The slices don't line up with frames, so frames in progress
+ * are compared too. Without ROM arguments, a built-in program is used
+ * that keeps writing SCX, WX and OBP0, also during mode 3.
+ */
+
+#define CHECK_FRAMES 120
+#define CHECK_SLICE 12345 // T-cycles run between comparisons, not a divisor of a frame
+
+// Fills the tiles, the background map and OAM, sets up the LCD, then loops writing registers
+static const uint8_t check_program[] = {
+    0xF3,                               // di
+    0xF0, 0x44, 0xFE, 0x90, 0x20, 0xFA, // Wait for line 144
+    0x3E, 0x00, 0xE0, 0x40,             // LCD off
+    0x21, 0x00, 0x80,                   // Tiles from 0x8000 to 0x97FF get L ^ H
+    0x7D, 0xAC, 0x22, 0x7C, 0xFE, 0x98, 0x20, 0xF8,
+    0x21, 0x00, 0x98,                   // Background maps get L + H
+    0x7D, 0x84, 0x22, 0x7C, 0xFE, 0xA0, 0x20, 0xF8,
+    0x21, 0x00, 0xFE,                   // OAM gets L
+    0x7D, 0x22, 0x7D, 0xFE, 0xA0, 0x20, 0xF9,
+    0x3E, 0x05, 0xE0, 0x43,             // SCX
+    0x3E, 0x03, 0xE0, 0x42,             // SCY
+    0x3E, 0x28, 0xE0, 0x4A,             // WY
+    0x3E, 0x3C, 0xE0, 0x4B,             // WX
+    0x3E, 0xE4, 0xE0, 0x48,             // OBP0
+    0x3E, 0x1B, 0xE0, 0x49,             // OBP1
+    0x3E, 0xD2, 0xE0, 0x47,             // BGP
+    0x3E, 0xF3, 0xE0, 0x40,             // LCD, window and objects on
+    0x3C,                               // inc a
+    0xE0, 0x43, 0xE0, 0x4B, 0xE0, 0x48, // SCX, WX and OBP0
+    0x18, 0xF7,                         // Loop
+};
+
+/**
+ * @brief Writes the built-in program as a ROM file
+ *
+ * @param path receives the file name, at least 32 bytes
+ * @return int 0 on success
+ */
+static int check_write_rom(char *path)
+{
+    static uint8_t rom[0x8000];
+
+    memset(rom, 0xFF, sizeof(rom));
+    memcpy(&rom[0x100], (const uint8_t[]){0x00, 0xC3, 0x50, 0x01}, 4); // nop, jp 0x0150
+    memset(&rom[0x134], 0x00, 0x1C);                                     // No MBC, no RAM, DMG
+    memcpy(&rom[0x150], check_program, sizeof(check_program));
+
+    strcpy(path, "/tmp/nyanGBE_checkXXXXXX");
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return -1;
+
+    bool written = write(fd, rom, sizeof(rom)) == (ssize_t)sizeof(rom);
+    close(fd);
+
+    return written ? 0 : -1;
+}
+
+static void check_discard_serial(void *ctx, const uint8_t *data, size_t len)
+{
+    (void)ctx;
+    (void)data;
+    (void)len;
+}
+
+/**
+ * @brief Compares the render worker with synchronous rendering
+ *
+ * @param path ROM file
+ * @param renderer line renderer to use
+ * @return int 0 if every compared framebuffer matched, 1 if not, -1 on failure
+ */
+static int check_rom(const char *path, ppu_renderer_t renderer)
+{
+    static struct gb_s gb[2];
+
+    for (int i = 0; i < 2; i++)
+    {
+        gb_init(&gb[i]);
+        if (gb_load_rom(&gb[i], path) != 0 || ppu_set_renderer(&gb[i], renderer) != 0)
+            return -1;
+
+        // Only the frames are of interest
+        apu_set_synth(&gb[i], false);
+        serial_set_sink(&gb[i], check_discard_serial, NULL);
+    }
+
+    if (ppu_worker_start(&gb[1]) != 0)
+        return -1;
+
+    int result = 0;
+    uint64_t end = CHECK_FRAMES * GB_FRAME_CYCLES;
+
+    for (uint64_t until = CHECK_SLICE; until < end && !result; until += CHECK_SLICE)
+    {
+        gb_run(&gb[0], until);
+        gb_run(&gb[1], until);
+        ppu_worker_sync(&gb[1]);
+
+        if (memcmp(gb[0].ppu.framebuffer, gb[1].ppu.framebuffer, sizeof(gb[0].ppu.framebuffer)) != 0)
+        {
+            printf("%s: frames differ at T-cycle %llu, line %u\n", path, (unsigned long long)until,
+                   (unsigned)(until % GB_FRAME_CYCLES / PPU_DOTS_PER_LINE));
+            result = 1;
+        }
+    }
+
+    ppu_worker_stop(&gb[1]);
+    gb_unload_rom(&gb[0]);
+    gb_unload_rom(&gb[1]);
+
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    char builtin[32];
+    int failed = 0;
+
+    if (argc < 2 && check_write_rom(builtin) != 0)
+    {
+        printf("Could not write the built-in test ROM\n");
+        return EXIT_FAILURE;
+    }
+
+    int roms = argc < 2 ? 1 : argc - 1;
+
+    for (int i = 0; i < roms; i++)
+    {
+        const char *path = argc < 2 ? builtin : argv[i + 1];
+
+        for (ppu_renderer_t renderer = PPU_RENDERER_SCANLINE; renderer <= PPU_RENDERER_FIFO; renderer++)
+        {
+#ifndef PPU_FIFO
+            if (renderer == PPU_RENDERER_FIFO)
+                continue;
+#endif
+            int result = check_rom(path, renderer);
+
+            if (result < 0)
+                return EXIT_FAILURE;
+
+            printf("%s, %s renderer: render worker %s\n", argc < 2 ? "Built-in ROM" : path,
+                   renderer == PPU_RENDERER_FIFO ? "pixel FIFO" : "scanline", result ? "DIFFERS" : "identical");
+            failed |= result;
+        }
+    }
+
+    if (argc < 2)
+        unlink(builtin);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,217 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "blip.h"
+#include "resample.h"
+
+/*
+ * Polyphase resampler
+ *
+ * Converts a stereo stream by an arbitrary ratio that can change at any
+ * time. Each output sample is a dot product of the input around its
+ * position with a windowed sinc, picked from a table by the sub-sample
+ * part of the position. The position advances by a fixed point step,
+ * so changing the ratio only changes how far the next sample lies and
+ * the output stays continuous.
+ *
+ * Samples and filter taps are 16 bit and the products are summed in 32
+ * bits, which SSE2 (pmaddwd) and NEON (vmlal) compute 8 and 4 taps at a
+ * time. Both channels share the loads of the filter phase. Integer sums
+ * don't depend on their order, so the vector filters give exactly the
+ * output of the plain C reference.
+ */
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define RESAMPLE_CUTOFF 0.9 // Of the lower Nyquist frequency
+
+/**
+ * @brief Filters both channels at one position, plain C
+ *
+ * @param left first left input sample under the filter
+ * @param right first right input sample under the filter
+ * @param kernel filter phase
+ * @param out receives the left and right output sample
+ */
+static void resample_filter_reference(const int16_t *left, const int16_t *right, const int16_t *kernel, int16_t *out)
+{
+    int32_t sum[2] = {0, 0};
+
+    for (int i = 0; i < RESAMPLE_TAPS; i++)
+    {
+        sum[0] += left[i] * kernel[i];
+        sum[1] += right[i] * kernel[i];
+    }
+
+    for (int ch = 0; ch < 2; ch++)
+    {
+        int32_t s = (sum[ch] + (1 << (RESAMPLE_KERNEL_BITS - 1))) >> RESAMPLE_KERNEL_BITS;
+        out[ch] = s > INT16_MAX ? INT16_MAX : s < INT16_MIN ? INT16_MIN : s;
+    }
+}
+
+/**
+ * @brief Filters both channels at one position, vectorized where available
+ *
+ * @param left first left input sample under the filter
+ * @param right first right input sample under the filter
+ * @param kernel filter phase
+ * @param out receives the left and right output sample
+ */
+static inline void resample_filter(const int16_t *left, const int16_t *right, const int16_t *kernel, int16_t *out)
+{
+#if defined(__SSE2__)
+    __m128i l = _mm_setzero_si128();
+    __m128i r = _mm_setzero_si128();
+
+    for (int i = 0; i < RESAMPLE_TAPS; i += 8)
+    {
+        __m128i k = _mm_loadu_si128((const __m128i *)&kernel[i]);
+        l = _mm_add_epi32(l, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)&left[i]), k));
+        r = _mm_add_epi32(r, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)&right[i]), k));
+    }
+
+    // Left sum in lane 0, right sum in lane 1
+    __m128i sum = _mm_add_epi32(_mm_unpacklo_epi32(l, r), _mm_unpackhi_epi32(l, r));
+    sum = _mm_add_epi32(sum, _mm_srli_si128(sum, 8));
+    sum = _mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(1 << (RESAMPLE_KERNEL_BITS - 1))), RESAMPLE_KERNEL_BITS);
+
+    int32_t pair = _mm_cvtsi128_si32(_mm_packs_epi32(sum, sum));
+    memcpy(out, &pair, sizeof(pair));
+#elif defined(__ARM_NEON)
+    int32x4_t l = vdupq_n_s32(0);
+    int32x4_t r = vdupq_n_s32(0);
+
+    for (int i = 0; i < RESAMPLE_TAPS; i += 4)
+    {
+        int16x4_t k = vld1_s16(&kernel[i]);
+        l = vmlal_s16(l, vld1_s16(&left[i]), k);
+        r = vmlal_s16(r, vld1_s16(&right[i]), k);
+    }
+
+    // Left sum in lane 0, right sum in lane 1
+    int32x2_t sum = vpadd_s32(vadd_s32(vget_low_s32(l), vget_high_s32(l)), vadd_s32(vget_low_s32(r), vget_high_s32(r)));
+    int16x4_t pair = vqrshrn_n_s32(vcombine_s32(sum, sum), RESAMPLE_KERNEL_BITS);
+
+    vst1_lane_s32((int32_t *)out, vreinterpret_s32_s16(pair), 0);
+#else
+    resample_filter_reference(left, right, kernel, out);
+#endif
+}
+
+/**
+ * @brief Fills the filter table for a ratio
+ *
+ * Built like the step kernel of the blip buffer.
+ *
+ * @param r resampler
+ * @param ratio output samples per input sample
+ */
+static void resample_init_kernel(struct resample_s *r, double ratio)
+{
+    // Below the lowest of both Nyquist frequencies
+    double cutoff = RESAMPLE_CUTOFF * (ratio < 1.0 ? ratio : 1.0);
+
+    blip_windowed_sinc(&r->kernel[0][0], RESAMPLE_PHASES, RESAMPLE_TAPS, cutoff, RESAMPLE_KERNEL_BITS);
+}
+
+/**
+ * @brief Sets up an empty resampler
+ *
+ * The filter is designed for this ratio. Later changes should stay
+ * close to it, as for rate control.
+ *
+ * @param r resampler
+ * @param ratio output samples per input sample
+ */
+void resample_init(struct resample_s *r, double ratio)
+{
+    memset(r, 0, sizeof(*r));
+    resample_init_kernel(r, ratio);
+    resample_set_ratio(r, ratio);
+
+    // Silence before the first sample, so it lines up with the first output
+    r->count = RESAMPLE_TAPS / 2 - 1;
+}
+
+/**
+ * @brief Changes the ratio from the next output sample on
+ *
+ * @param r resampler
+ * @param ratio output samples per input sample
+ */
+void resample_set_ratio(struct resample_s *r, double ratio)
+{
+    r->step = (uint64_t)(4294967296.0 / ratio + 0.5);
+}
+
+/**
+ * @brief Queues input samples
+ *
+ * @param r resampler
+ * @param in interleaved left/right samples
+ * @param count number of stereo samples
+ * @return uint32_t stereo samples taken, less than count once the buffer is full
+ */
+uint32_t resample_write(struct resample_s *r, const int16_t *in, uint32_t count)
+{
+    uint32_t space = RESAMPLE_BUFFER - r->count;
+
+    if (count > space)
+        count = space;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        r->in[0][r->count + i] = in[i * 2];
+        r->in[1][r->count + i] = in[i * 2 + 1];
+    }
+
+    r->count += count;
+    return count;
+}
+
+/**
+ * @brief Produces output samples from the queued input
+ *
+ * @param r resampler
+ * @param out receives interleaved left/right samples
+ * @param max maximum number of stereo samples
+ * @return uint32_t stereo samples produced
+ */
+uint32_t resample_read(struct resample_s *r, int16_t *out, uint32_t max)
+{
+    uint32_t n = 0;
+
+    while (n < max && (r->pos >> 32) + RESAMPLE_TAPS <= r->count)
+    {
+        uint32_t index = r->pos >> 32;
+        const int16_t *kernel = r->kernel[(r->pos >> (32 - RESAMPLE_PHASE_BITS)) & (RESAMPLE_PHASES - 1)];
+
+        if (r->reference)
+            resample_filter_reference(&r->in[0][index], &r->in[1][index], kernel, &out[n * 2]);
+        else
+            resample_filter(&r->in[0][index], &r->in[1][index], kernel, &out[n * 2]);
+
+        r->pos += r->step;
+        n++;
+    }
+
+    // Input no longer under the filter is dropped
+    uint32_t used = r->pos >> 32;
+    if (used > r->count)
+        used = r->count;
+
+    if (used)
+    {
+        memmove(r->in[0], &r->in[0][used], (r->count - used) * sizeof(r->in[0][0]));
+        memmove(r->in[1], &r->in[1][used], (r->count - used) * sizeof(r->in[1][0]));
+        r->count -= used;
+        r->pos -= (uint64_t)used << 32;
+    }
+
+    return n;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define RESAMPLE_PHASE_BITS 7
+#define RESAMPLE_PHASES (1 << RESAMPLE_PHASE_BITS) // Sub-sample positions of the filter
+#define RESAMPLE_TAPS 32                           // Input samples per output sample, a multiple of 8
+#define RESAMPLE_KERNEL_BITS 14                    // Fixed point precision of the filter
+#define RESAMPLE_BUFFER 1024                       // Input samples buffered, including the filter history
+
+/* Stereo polyphase resampler */
+struct resample_s
+{
+    uint64_t step;  // Input samples per output sample, 32.32 fixed point
+    uint64_t pos;   // Position of the next output sample's first tap in the buffer, 32.32 fixed point
+    uint32_t count; // Input samples in the buffer
+    bool reference; // Use the plain C filter, for comparisons
+    int16_t kernel[RESAMPLE_PHASES][RESAMPLE_TAPS];
+    int16_t in[2][RESAMPLE_BUFFER]; // Left and right apart, so the taps of a channel are contiguous
+};
+
+void resample_init(struct resample_s *r, double ratio);
+void resample_set_ratio(struct resample_s *r, double ratio);
+uint32_t resample_write(struct resample_s *r, const int16_t *in, uint32_t count);
+uint32_t resample_read(struct resample_s *r, int16_t *out, uint32_t max);
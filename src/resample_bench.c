@@ -0,0 +1,133 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "resample.h"
+
+/*
+ * Resampler benchmark
+ *
+ * Runs the same input through the vectorized filter and the plain C
+ * reference, a frame of samples at a time with the ratio wobbling like
+ * under rate control, and compares speed and output. The outputs have
+ * to match exactly.
+ */
+
+#define BENCH_RATE 48000
+#define BENCH_FRAME 800 // Input samples per call, about one emulated frame
+
+#if defined(__SSE2__)
+#define BENCH_VECTOR "SSE2"
+#elif defined(__ARM_NEON)
+#define BENCH_VECTOR "NEON"
+#else
+#define BENCH_VECTOR "none"
+#endif
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Resamples the whole input
+ *
+ * @param r resampler, set up by the caller
+ * @param in interleaved input
+ * @param count stereo input samples
+ * @param ratio nominal output samples per input sample
+ * @param out receives the interleaved output
+ * @param max capacity of out in stereo samples
+ * @return uint32_t stereo samples produced
+ */
+static uint32_t bench_run(struct resample_s *r, const int16_t *in, uint32_t count, double ratio, int16_t *out,
+                          uint32_t max)
+{
+    uint32_t produced = 0;
+
+    for (uint32_t frame = 0; frame * BENCH_FRAME < count; frame++)
+    {
+        uint32_t left = count - frame * BENCH_FRAME < BENCH_FRAME ? count - frame * BENCH_FRAME : BENCH_FRAME;
+        const int16_t *src = &in[frame * BENCH_FRAME * 2];
+
+        // Rate control moves by less than a percent
+        resample_set_ratio(r, ratio * (1.0 + 0.005 * sin(frame * 0.05)));
+
+        while (left)
+        {
+            uint32_t taken = resample_write(r, src, left);
+
+            src += taken * 2;
+            left -= taken;
+            produced += resample_read(r, &out[produced * 2], max - produced);
+        }
+    }
+
+    return produced;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned seconds = argc > 1 ? strtoul(argv[1], NULL, 0) : 60;
+    double ratio = argc > 2 ? strtod(argv[2], NULL) : 1.0;
+    uint32_t count = seconds * BENCH_RATE;
+    uint32_t max = (uint32_t)(count * ratio * 1.01) + RESAMPLE_TAPS;
+
+    if (!seconds || ratio < 0.1 || ratio > 10.0)
+    {
+        printf("Usage: %s [seconds] [ratio]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int16_t *in = malloc(count * 2 * sizeof(*in));
+    int16_t *out[2] = {malloc(max * 2 * sizeof(int16_t)), malloc(max * 2 * sizeof(int16_t))};
+    struct resample_s *r = malloc(sizeof(*r));
+
+    if (!in || !out[0] || !out[1] || !r)
+        return EXIT_FAILURE;
+
+    // Square waves and noise at a typical APU level
+    uint32_t lfsr = 1;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        lfsr = lfsr * 1664525 + 1013904223;
+        int noise = (int)(lfsr >> 22) - 512;
+
+        in[i * 2] = (i / 55 % 2 ? 6000 : -6000) + (i / 17 % 2 ? 2000 : -2000) + noise;
+        in[i * 2 + 1] = (i / 73 % 2 ? 6000 : -6000) + noise * 4;
+    }
+
+    double elapsed[2];
+    uint32_t produced[2];
+
+    for (int reference = 0; reference < 2; reference++)
+    {
+        resample_init(r, ratio);
+        r->reference = reference;
+
+        double start = now();
+        produced[reference] = bench_run(r, in, count, ratio, out[reference], max);
+        elapsed[reference] = now() - start;
+
+        printf("%-9s %u samples, %.2f ns per output sample, %.0fx real time\n", reference ? "Reference" : "Vector",
+               produced[reference], elapsed[reference] * 1e9 / produced[reference], seconds / elapsed[reference]);
+    }
+
+    bool match = produced[0] == produced[1] && memcmp(out[0], out[1], produced[0] * 2 * sizeof(int16_t)) == 0;
+
+    printf("Vector unit %s, %.2fx the reference speed, output %s\n", BENCH_VECTOR, elapsed[1] / elapsed[0],
+           match ? "identical" : "DIFFERS");
+
+    free(in);
+    free(out[0]);
+    free(out[1]);
+    free(r);
+
+    return match ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,297 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "gb.h"
+#include "memory.h"
+#include "save.h"
+
+/*
+ * Cartridge RAM
+ *
+ * Battery backed RAM is a shared mapping of the .sav file next to the
+ * ROM, so the emulation writes straight into the page cache: once
+ * written, a byte survives the emulator crashing, and nothing in the
+ * frame loop ever touches the disk. Writes set a bit per page in a
+ * dirty bitmap, a flusher thread takes the bits every SAVE_FLUSH_MS
+ * and syncs those pages to disk, which bounds what a system crash can
+ * lose. Cartridges without a battery get anonymous memory.
+ */
+
+/**
+ * @brief Returns the cartridge RAM size from the ROM header
+ *
+ * @param code RAM size byte of the header
+ * @return size_t size in bytes, 0 without RAM
+ */
+static size_t save_ram_size(uint8_t code)
+{
+    switch (code)
+    {
+    case 0x01: // 2 KiB, only the start of the window
+    case 0x02:
+        return 0x2000;
+    case 0x03:
+        return 0x8000;
+    case 0x04:
+        return 0x20000;
+    case 0x05:
+        return 0x10000;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Checks whether the cartridge type has a battery
+ *
+ * @param type cartridge type byte of the header
+ * @return true if its RAM keeps its contents
+ */
+static bool save_has_battery(uint8_t type)
+{
+    switch (type)
+    {
+    case 0x03: // MBC1+RAM+BATTERY
+    case 0x06: // MBC2+BATTERY
+    case 0x09: // ROM+RAM+BATTERY
+    case 0x0D: // MMM01+RAM+BATTERY
+    case 0x0F: // MBC3+TIMER+BATTERY
+    case 0x10: // MBC3+TIMER+RAM+BATTERY
+    case 0x13: // MBC3+RAM+BATTERY
+    case 0x1B: // MBC5+RAM+BATTERY
+    case 0x1E: // MBC5+RUMBLE+RAM+BATTERY
+    case 0x22: // MBC7+SENSOR+RUMBLE+RAM+BATTERY
+    case 0xFF: // HuC1+RAM+BATTERY
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief Writes the pages marked dirty back to the file
+ *
+ * Adjacent pages are synced with one call.
+ *
+ * @param save cartridge RAM
+ */
+static void save_flush(struct save_s *save)
+{
+    uint64_t dirty = atomic_exchange_explicit(&save->dirty, 0, memory_order_acquire);
+    size_t pages = save->size / SAVE_PAGE_SIZE;
+
+    for (size_t first = 0; dirty && first < pages; first++)
+    {
+        if (!(dirty & (1ull << first)))
+            continue;
+
+        size_t last = first;
+        while (last + 1 < pages && (dirty & (1ull << (last + 1))))
+            last++;
+
+        if (msync(save->data + first * SAVE_PAGE_SIZE, (last - first + 1) * SAVE_PAGE_SIZE, MS_SYNC) != 0 &&
+            !save->failed)
+        {
+            printf("Could not write the save file: %s\n", strerror(errno));
+            save->failed = true;
+        }
+
+        save->flushes++;
+        first = last;
+    }
+}
+
+static void *save_main(void *arg)
+{
+    struct save_s *save = arg;
+
+    pthread_mutex_lock(&save->lock);
+
+    while (!save->quit)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += SAVE_FLUSH_MS / 1000;
+        deadline.tv_nsec += (SAVE_FLUSH_MS % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        pthread_cond_timedwait(&save->cond, &save->lock, &deadline);
+
+        pthread_mutex_unlock(&save->lock);
+        save_flush(save);
+        pthread_mutex_lock(&save->lock);
+    }
+
+    pthread_mutex_unlock(&save->lock);
+    return NULL;
+}
+
+/**
+ * @brief Maps the save file, creating or growing it as needed
+ *
+ * @param save cartridge RAM
+ * @param rom_path path of the ROM, the extension is replaced by .sav
+ * @return int 0 on success
+ */
+static int save_map_file(struct save_s *save, const char *rom_path)
+{
+    char path[4096];
+    const char *slash = strrchr(rom_path, '/');
+    const char *dot = strrchr(slash ? slash : rom_path, '.');
+    int len = dot ? (int)(dot - rom_path) : (int)strlen(rom_path);
+
+    if (snprintf(path, sizeof(path), "%.*s.sav", len, rom_path) >= (int)sizeof(path))
+    {
+        printf("Save file path too long\n");
+        return -1;
+    }
+
+    save->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (save->fd < 0)
+    {
+        printf("Could not open save file %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    // New files start out zeroed, shorter ones (e.g. from other emulators) are padded
+    struct stat st;
+    if (fstat(save->fd, &st) != 0 || ((size_t)st.st_size < save->size && ftruncate(save->fd, save->size) != 0))
+    {
+        printf("Could not size save file %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    // Populated right away, so the emulation doesn't wait for the file on first access
+    save->data = mmap(NULL, save->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, save->fd, 0);
+    if (save->data == MAP_FAILED)
+    {
+        printf("Could not map save file %s: %s\n", path, strerror(errno));
+        save->data = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Sets up the cartridge RAM of a loaded ROM and plugs it in
+ *
+ * Does nothing for cartridges without RAM.
+ *
+ * @param save cartridge RAM, must stay in place until closed
+ * @param gb gameboy state struct with the ROM loaded
+ * @param rom_path path of the ROM, the save file is stored next to it
+ * @return int 0 on success
+ */
+int save_open(struct save_s *save, struct gb_s *gb, const char *rom_path)
+{
+    memset(save, 0, sizeof(*save));
+    save->fd = -1;
+    atomic_init(&save->dirty, 0);
+
+    save->size = save_ram_size(gb->memory.rom[GB_RAM_SIZE]);
+    if (!save->size)
+        return 0;
+
+    save->scratch = mmap(NULL, save->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (save->scratch == MAP_FAILED)
+    {
+        printf("Could not allocate cartridge RAM\n");
+        save->scratch = NULL;
+        return -1;
+    }
+
+    if (!save_has_battery(gb->memory.rom[GB_CART_TYPE]))
+    {
+        save->data = mmap(NULL, save->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (save->data == MAP_FAILED)
+        {
+            printf("Could not allocate cartridge RAM\n");
+            save->data = NULL;
+            save_close(save);
+            return -1;
+        }
+    }
+    else
+    {
+        if (save_map_file(save, rom_path) != 0)
+        {
+            save_close(save);
+            return -1;
+        }
+
+        pthread_mutex_init(&save->lock, NULL);
+        pthread_cond_init(&save->cond, NULL);
+
+        if (pthread_create(&save->thread, NULL, save_main, save) != 0)
+        {
+            printf("Could not start save file flusher\n");
+            pthread_cond_destroy(&save->cond);
+            pthread_mutex_destroy(&save->lock);
+            save_close(save);
+            return -1;
+        }
+    }
+
+    save->gb = gb;
+    gb->memory.cart_ram = save->data;
+    gb->memory.cart_ram_size = save->size;
+    gb->memory.save = save;
+    memory_map(gb);
+
+    return 0;
+}
+
+/**
+ * @brief Unplugs the cartridge RAM and writes back what is left
+ *
+ * @param save cartridge RAM
+ */
+void save_close(struct save_s *save)
+{
+    if (save->gb)
+    {
+        save->gb->memory.cart_ram = NULL;
+        save->gb->memory.save = NULL;
+        memory_map(save->gb);
+        save->gb = NULL;
+
+        if (save->fd >= 0)
+        {
+            pthread_mutex_lock(&save->lock);
+            save->quit = true;
+            pthread_cond_signal(&save->cond);
+            pthread_mutex_unlock(&save->lock);
+
+            pthread_join(save->thread, NULL);
+            pthread_cond_destroy(&save->cond);
+            pthread_mutex_destroy(&save->lock);
+
+            save_flush(save);
+        }
+    }
+
+    if (save->data)
+        munmap(save->data, save->size);
+    if (save->scratch)
+        munmap(save->scratch, save->size);
+    if (save->fd >= 0)
+        close(save->fd);
+
+    save->data = NULL;
+    save->scratch = NULL;
+    save->fd = -1;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SAVE_PAGE_SIZE 0x1000 // Dirty tracking granularity, a host page
+#define SAVE_MAX_SIZE 0x20000 // Largest cartridge RAM, one dirty bit per page fits a word
+#define SAVE_FLUSH_MS 1000    // Dirty pages are written back at least this often
+
+struct gb_s;
+
+/* Cartridge RAM, mapped from a .sav file for cartridges with a battery */
+struct save_s
+{
+    uint8_t *data;
+    uint8_t *scratch; // Copy for speculative runs, see memory_detach_save()
+    size_t size;
+    int fd;          // Save file, -1 without a battery
+    struct gb_s *gb; // Instance the RAM is plugged into
+
+    atomic_uint_least64_t dirty; // One bit per page written since the last flush
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool quit;
+
+    // Flusher only until it was joined
+    uint64_t flushes; // msync() calls
+    bool failed;      // A flush failed, the file may be behind
+};
+
+int save_open(struct save_s *save, struct gb_s *gb, const char *rom_path);
+void save_close(struct save_s *save);
+
+/**
+ * @brief Marks a byte of cartridge RAM as written
+ *
+ * The release pairs with the flusher taking the bits, so the data is
+ * in place once it sees them.
+ *
+ * @param save cartridge RAM
+ * @param offset offset of the byte written
+ */
+static inline void save_mark(struct save_s *save, uint32_t offset)
+{
+    atomic_fetch_or_explicit(&save->dirty, 1ull << (offset / SAVE_PAGE_SIZE), memory_order_release);
+}
@@ -0,0 +1,137 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include "gb.h"
+#include "apu.h"
+#include "dma.h"
+#include "ppu.h"
+#include "sched.h"
+#include "serial.h"
+
+/*
+ * Event scheduler
+ *
+ * Components that only need to act at known points in time (line
+ * starts, interrupts, ...) schedule an event at a T-cycle timestamp
+ * instead of being ticked on every instruction. The CPU only compares
+ * the clock against the earliest pending event.
+ */
+
+static void sched_update_next(struct sched_s *sched)
+{
+    sched->next = SCHED_NEVER;
+
+    for (int event = 0; event < SCHED_NUM_EVENTS; event++)
+    {
+        if (sched->when[event] < sched->next)
+            sched->next = sched->when[event];
+    }
+}
+
+void sched_init(struct gb_s *gb)
+{
+    for (int event = 0; event < SCHED_NUM_EVENTS; event++)
+    {
+        gb->sched.when[event] = SCHED_NEVER;
+    }
+
+    gb->sched.next = SCHED_NEVER;
+}
+
+/**
+ * @brief Schedules an event, replacing a pending one of the same kind
+ *
+ * @param gb gameboy state struct
+ * @param event event to schedule
+ * @param when T-cycle timestamp to dispatch the event at
+ */
+void sched_add(struct gb_s *gb, sched_event_t event, uint64_t when)
+{
+    gb->sched.when[event] = when;
+    sched_update_next(&gb->sched);
+}
+
+/**
+ * @brief Removes a pending event
+ *
+ * @param gb gameboy state struct
+ * @param event event to remove
+ */
+void sched_remove(struct gb_s *gb, sched_event_t event)
+{
+    gb->sched.when[event] = SCHED_NEVER;
+    sched_update_next(&gb->sched);
+}
+
+static void sched_dispatch(struct gb_s *gb, sched_event_t event, uint64_t when)
+{
+    switch (event)
+    {
+    case SCHED_PPU_LINE:
+        ppu_line_event(gb, when);
+        break;
+
+    case SCHED_PPU_VBLANK:
+        ppu_vblank_event(gb, when);
+        break;
+
+    case SCHED_PPU_STAT:
+        ppu_stat_event(gb, when);
+        break;
+
+    case SCHED_APU_FRAME:
+        apu_frame_event(gb, when);
+        break;
+
+    case SCHED_SERIAL:
+        serial_transfer_event(gb, when);
+        break;
+
+    case SCHED_LINK:
+        serial_link_event(gb, when);
+        break;
+
+    case SCHED_DMA_OAM:
+        dma_oam_event(gb, when);
+        break;
+
+    case SCHED_HDMA:
+        dma_hdma_event(gb, when);
+        break;
+
+    default:
+        printf("Unknown scheduler event %d\n", event);
+        assert(!"Unknown scheduler event");
+        break;
+    }
+}
+
+/**
+ * @brief Dispatches all events that are due
+ *
+ * Events are dispatched in timestamp order and may schedule new ones.
+ *
+ * @param gb gameboy state struct
+ */
+void sched_run(struct gb_s *gb)
+{
+    struct sched_s *sched = &gb->sched;
+
+    while (sched->next <= gb->clock)
+    {
+        sched_event_t event = 0;
+
+        for (int i = 1; i < SCHED_NUM_EVENTS; i++)
+        {
+            if (sched->when[i] < sched->when[event])
+                event = i;
+        }
+
+        uint64_t when = sched->when[event];
+        sched->when[event] = SCHED_NEVER;
+        sched_update_next(sched);
+
+        sched_dispatch(gb, event, when);
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+#define SCHED_NEVER UINT64_MAX
+
+/* Scheduled events, ties are dispatched in this order */
+typedef enum sched_event
+{
+    SCHED_PPU_LINE,   // Mode 3 start of a visible line
+    SCHED_PPU_VBLANK, // Start of line 144
+    SCHED_PPU_STAT,   // Rising edge of the STAT interrupt line
+    SCHED_APU_FRAME,  // End of an audio output frame
+    SCHED_SERIAL,     // Serial transfer complete
+    SCHED_LINK,       // Transfer clocked by the link cable partner complete
+    SCHED_DMA_OAM,    // OAM DMA transfer complete
+    SCHED_HDMA,       // HBlank start with a CGB HBlank DMA transfer running
+    SCHED_NUM_EVENTS
+} sched_event_t;
+
+/* Event scheduler state */
+struct sched_s
+{
+    uint64_t next;                   // Timestamp of the earliest pending event
+    uint64_t when[SCHED_NUM_EVENTS]; // Timestamp per event, SCHED_NEVER if not pending
+};
+
+struct gb_s;
+
+void sched_init(struct gb_s *gb);
+void sched_add(struct gb_s *gb, sched_event_t event, uint64_t when);
+void sched_remove(struct gb_s *gb, sched_event_t event);
+void sched_run(struct gb_s *gb);
@@ -0,0 +1,163 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include "gb.h"
+#include "cpu.h"
+#include "link.h"
+#include "sched.h"
+#include "serial.h"
+
+/*
+ * Serial port
+ *
+ * Writing SC with the start bit and the internal clock starts a
+ * transfer, which completes 8 bit times later as a scheduler event:
+ * SB is sent, the bits shifted in (all ones from an unconnected line)
+ * replace it, the start bit clears and the serial interrupt is raised.
+ * With the external clock nothing happens unless a link cable partner
+ * drives it, see link.c: the partner's transfers arrive as scheduler
+ * events at their completion time, and the bytes are swapped there.
+ *
+ * Sent bytes are collected and passed to a sink in blocks, at the
+ * latest when gb_run() returns. Sinks for stdio streams and memory
+ * are provided, anything else can be plugged in as a callback.
+ */
+
+#define SC_TRANSFER_START 0x80
+#define SC_INTERNAL_CLOCK 0x01
+
+void serial_init(struct gb_s *gb)
+{
+    serial_set_sink(gb, NULL, NULL);
+}
+
+/**
+ * @brief Sets the receiver of outgoing serial bytes
+ *
+ * Bytes still buffered go to the previous sink first.
+ *
+ * @param gb gameboy state struct
+ * @param sink function called with blocks of sent bytes, NULL to restore stdout
+ * @param ctx passed to the sink
+ */
+void serial_set_sink(struct gb_s *gb, serial_sink_t sink, void *ctx)
+{
+    if (gb->serial.sink)
+        serial_flush(gb);
+
+    gb->serial.sink = sink ? sink : serial_sink_stdio;
+    gb->serial.sink_ctx = sink ? ctx : NULL;
+}
+
+/**
+ * @brief Passes the buffered bytes to the sink
+ *
+ * @param gb gameboy state struct
+ */
+void serial_flush(struct gb_s *gb)
+{
+    struct serial_s *serial = &gb->serial;
+
+    if (!serial->buffered)
+        return;
+
+    serial->sink(serial->sink_ctx, serial->buffer, serial->buffered);
+    serial->buffered = 0;
+}
+
+/**
+ * @brief Write byte to SC
+ *
+ * Starts a transfer with the internal clock, clearing the start bit
+ * cancels a running one.
+ *
+ * @param gb gameboy state struct
+ * @param data byte to write
+ */
+void serial_write_control(struct gb_s *gb, uint8_t data)
+{
+    uint8_t old = gb->memory.ram[GB_SC - 0x8000];
+
+    gb->memory.ram[GB_SC - 0x8000] = data;
+
+    if (!(data & SC_TRANSFER_START) || !(data & SC_INTERNAL_CLOCK))
+        sched_remove(gb, SCHED_SERIAL);
+    else if (!(old & SC_TRANSFER_START) || !(old & SC_INTERNAL_CLOCK))
+    {
+        // Twice as fast in CGB double speed mode
+        uint64_t when = gb->clock + ((8 * SERIAL_BIT_CYCLES) >> gb->double_speed);
+
+        sched_add(gb, SCHED_SERIAL, when);
+        if (gb->serial.link)
+            link_start(gb->serial.link, gb->memory.ram[GB_SB - 0x8000], when);
+    }
+}
+
+/**
+ * @brief Swaps SB with the shifted in byte and signals the end of a transfer
+ *
+ * @param gb gameboy state struct
+ * @param in byte shifted in
+ */
+static void serial_complete(struct gb_s *gb, uint8_t in)
+{
+    struct serial_s *serial = &gb->serial;
+
+    serial->buffer[serial->buffered++] = gb->memory.ram[GB_SB - 0x8000];
+    if (serial->buffered == SERIAL_BUFFER_SIZE)
+        serial_flush(gb);
+
+    gb->memory.ram[GB_SB - 0x8000] = in;
+    gb->memory.ram[GB_SC - 0x8000] &= ~SC_TRANSFER_START;
+    cpu_raise_interrupt(gb, IR_SERIAL);
+}
+
+/**
+ * @brief Completes a transfer with the internal clock
+ *
+ * @param gb gameboy state struct
+ * @param when T-cycle timestamp of the last bit
+ */
+void serial_transfer_event(struct gb_s *gb, uint64_t when)
+{
+    serial_complete(gb, gb->serial.link ? link_finish(gb->serial.link, when) : 0xFF);
+}
+
+/**
+ * @brief Completes a transfer clocked by the link cable partner
+ *
+ * The partner gets SB either way, it only changes here if a transfer
+ * with the external clock was started.
+ *
+ * @param gb gameboy state struct
+ * @param when T-cycle timestamp of the last bit
+ */
+void serial_link_event(struct gb_s *gb, uint64_t when)
+{
+    uint8_t control = gb->memory.ram[GB_SC - 0x8000];
+
+    (void)when;
+
+    if (!gb->serial.link)
+        return;
+
+    uint8_t in = link_answer(gb->serial.link, gb->memory.ram[GB_SB - 0x8000]);
+
+    if ((control & SC_TRANSFER_START) && !(control & SC_INTERNAL_CLOCK))
+        serial_complete(gb, in);
+}
+
+/**
+ * @brief Sink writing to a stdio stream
+ *
+ * @param ctx FILE pointer, NULL for stdout
+ * @param data sent bytes
+ * @param len number of bytes
+ */
+void serial_sink_stdio(void *ctx, const uint8_t *data, size_t len)
+{
+    FILE *file = ctx ? ctx : stdout;
+
+    fwrite(data, 1, len, file);
+    fflush(file);
+}
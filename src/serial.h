@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SERIAL_BIT_CYCLES 512 // T-cycles per bit with the internal clock (8192 Hz)
+#define SERIAL_BUFFER_SIZE 256
+
+/* Receives the bytes sent over the serial port, a block at a time */
+typedef void (*serial_sink_t)(void *ctx, const uint8_t *data, size_t len);
+
+/* Serial port host connection, the transfer state lives in SB/SC and the scheduler */
+struct serial_s
+{
+    serial_sink_t sink;
+    void *sink_ctx;
+    uint8_t buffer[SERIAL_BUFFER_SIZE]; // Sent bytes not passed to the sink yet
+    size_t buffered;
+    struct link_s *link; // Link cable partner, NULL when unconnected
+};
+
+struct gb_s;
+struct link_s;
+
+void serial_init(struct gb_s *gb);
+void serial_set_sink(struct gb_s *gb, serial_sink_t sink, void *ctx);
+void serial_flush(struct gb_s *gb);
+void serial_write_control(struct gb_s *gb, uint8_t data);
+void serial_transfer_event(struct gb_s *gb, uint64_t when);
+void serial_link_event(struct gb_s *gb, uint64_t when);
+
+void serial_sink_stdio(void *ctx, const uint8_t *data, size_t len);
@@ -0,0 +1,88 @@
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+#include "shm_fb.h"
+
+/*
+ * Example frame consumer
+ *
+ * Follows the frame ring of a running instance started with --shm and
+ * prints a hash of every frame, working on the frames in place. Meant
+ * as a starting point for recorders and bots.
+ */
+
+static volatile sig_atomic_t keep_running = 1;
+
+static void sig_handler(int _)
+{
+    (void)_;
+    keep_running = 0;
+}
+
+static uint32_t fnv1a(const uint8_t *data, size_t len)
+{
+    uint32_t hash = 0x811C9DC5;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= data[i];
+        hash *= 0x01000193;
+    }
+
+    return hash;
+}
+
+int main(int argc, char **argv)
+{
+    struct shm_fb_s fb;
+    struct shm_fb_frame_s frame;
+    uint64_t frames = 0, dropped = 0, torn = 0;
+    uint64_t limit = argc > 2 ? strtoull(argv[2], NULL, 0) : 0;
+
+    if (argc < 2)
+    {
+        printf("Usage: %s <name> [frames]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (shm_fb_open(&fb, argv[1]) != 0)
+        return EXIT_FAILURE;
+
+    signal(SIGINT, sig_handler);
+
+    size_t size = (size_t)fb.header->width * fb.header->height;
+    int ret;
+
+    while (keep_running && (!limit || frames < limit) && (ret = shm_fb_next(&fb, &frame)) >= 0)
+    {
+        if (ret == 0)
+        {
+            // Nothing new, a frame takes about 16 ms at native speed
+            nanosleep(&(struct timespec){.tv_nsec = 1000000}, NULL);
+            continue;
+        }
+
+        uint32_t hash = fnv1a(frame.pixels, size);
+
+        if (!shm_fb_release(&fb, &frame))
+        {
+            // Overwritten while hashing, the hash is garbage
+            torn++;
+            continue;
+        }
+
+        printf("Frame %llu clock %llu hash %08X\n", (unsigned long long)frame.number,
+               (unsigned long long)frame.clock, hash);
+        frames++;
+        dropped += frame.dropped;
+    }
+
+    fprintf(stderr, "%llu frames, %llu dropped, %llu torn\n", (unsigned long long)frames,
+            (unsigned long long)dropped, (unsigned long long)torn);
+
+    shm_fb_close(&fb);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,295 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "shm_fb.h"
+
+/*
+ * Shared memory frame export
+ *
+ * Frames are published into a ring of slots in a POSIX shared memory
+ * object, which any number of local processes can map read-only. Each
+ * slot is guarded by a sequence counter (a seqlock): the writer makes it
+ * odd before overwriting the slot and sets it to twice the frame number
+ * afterwards. Readers never block the writer and never take a lock;
+ * they work on the frame in place and check the counter once they are
+ * done to find out whether it was overwritten in the meantime. A reader
+ * that stays less than a ring length behind never sees that happen.
+ *
+ * shm_open() is used rather than memfd_create(), since consumers find
+ * the ring by name instead of needing the descriptor passed to them.
+ */
+
+static size_t shm_fb_align(size_t size)
+{
+    return (size + SHM_FB_ALIGN - 1) & ~(size_t)(SHM_FB_ALIGN - 1);
+}
+
+static inline struct shm_fb_slot_s *shm_fb_slot(struct shm_fb_header_s *header, uint64_t frame)
+{
+    return (struct shm_fb_slot_s *)((uint8_t *)header + header->slot_offset + (frame % header->slots) * header->slot_size);
+}
+
+/**
+ * @brief Builds the shared memory object name
+ *
+ * @param fb ring
+ * @param name name given by the user, a leading slash is added if missing
+ * @return int 0 on success
+ */
+static int shm_fb_set_name(struct shm_fb_s *fb, const char *name)
+{
+    int len = snprintf(fb->name, sizeof(fb->name), "%s%s", name[0] == '/' ? "" : "/", name);
+
+    if (len < 2 || len >= (int)sizeof(fb->name) || strchr(fb->name + 1, '/'))
+    {
+        printf("Invalid shared memory name '%s'\n", name);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Creates a ring and maps it for writing
+ *
+ * An existing ring of the same name is replaced.
+ *
+ * @param fb ring
+ * @param name shared memory object name
+ * @param width frame width in pixels
+ * @param height frame height in pixels
+ * @param slots number of frames in the ring
+ * @return int 0 on success
+ */
+int shm_fb_create(struct shm_fb_s *fb, const char *name, uint32_t width, uint32_t height, uint32_t slots)
+{
+    memset(fb, 0, sizeof(*fb));
+
+    if (shm_fb_set_name(fb, name) != 0)
+        return -1;
+
+    size_t slot_offset = shm_fb_align(sizeof(struct shm_fb_header_s));
+    size_t slot_size = shm_fb_align(sizeof(struct shm_fb_slot_s)) + shm_fb_align((size_t)width * height);
+
+    fb->size = slot_offset + slots * slot_size;
+
+    shm_unlink(fb->name);
+    int fd = shm_open(fb->name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0)
+    {
+        printf("Could not create shared memory %s: %s\n", fb->name, strerror(errno));
+        return -1;
+    }
+
+    if (ftruncate(fd, fb->size) != 0)
+    {
+        printf("Could not size shared memory %s: %s\n", fb->name, strerror(errno));
+        close(fd);
+        shm_unlink(fb->name);
+        return -1;
+    }
+
+    fb->header = mmap(NULL, fb->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (fb->header == MAP_FAILED)
+    {
+        printf("Could not map shared memory %s: %s\n", fb->name, strerror(errno));
+        fb->header = NULL;
+        shm_unlink(fb->name);
+        return -1;
+    }
+
+    // Fresh objects are zero filled, so every slot starts out empty
+    struct shm_fb_header_s *header = fb->header;
+    header->width = width;
+    header->height = height;
+    header->slots = slots;
+    header->slot_size = slot_size;
+    header->slot_offset = slot_offset;
+    header->writer_pid = getpid();
+    header->version = SHM_FB_VERSION;
+    atomic_init(&header->latest, 0);
+    atomic_init(&header->closed, false);
+
+    // Readers check the magic last
+    atomic_thread_fence(memory_order_release);
+    header->magic = SHM_FB_MAGIC;
+
+    fb->owner = true;
+    return 0;
+}
+
+/**
+ * @brief Publishes a frame
+ *
+ * Never waits for readers; the oldest slot is overwritten.
+ *
+ * @param fb ring created with shm_fb_create()
+ * @param pixels width * height shades
+ * @param clock emulated clock at the end of the frame
+ */
+void shm_fb_publish(struct shm_fb_s *fb, const uint8_t *pixels, uint64_t clock)
+{
+    struct shm_fb_header_s *header = fb->header;
+    uint64_t frame = ++fb->frame;
+    struct shm_fb_slot_s *slot = shm_fb_slot(header, frame);
+
+    atomic_store_explicit(&slot->seq, frame * 2 - 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    slot->clock = clock;
+    memcpy(slot + 1, pixels, (size_t)header->width * header->height);
+
+    atomic_store_explicit(&slot->seq, frame * 2, memory_order_release);
+    atomic_store_explicit(&header->latest, frame, memory_order_release);
+}
+
+/**
+ * @brief Maps an existing ring for reading
+ *
+ * Reading starts with the latest frame published.
+ *
+ * @param fb ring
+ * @param name shared memory object name
+ * @return int 0 on success
+ */
+int shm_fb_open(struct shm_fb_s *fb, const char *name)
+{
+    struct stat st;
+
+    memset(fb, 0, sizeof(*fb));
+
+    if (shm_fb_set_name(fb, name) != 0)
+        return -1;
+
+    int fd = shm_open(fb->name, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        printf("Could not open shared memory %s: %s\n", fb->name, strerror(errno));
+        return -1;
+    }
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct shm_fb_header_s))
+    {
+        printf("Shared memory %s is not a frame ring\n", fb->name);
+        close(fd);
+        return -1;
+    }
+
+    fb->size = st.st_size;
+    fb->header = mmap(NULL, fb->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (fb->header == MAP_FAILED)
+    {
+        printf("Could not map shared memory %s: %s\n", fb->name, strerror(errno));
+        fb->header = NULL;
+        return -1;
+    }
+
+    const struct shm_fb_header_s *header = fb->header;
+    if (header->magic != SHM_FB_MAGIC || header->version != SHM_FB_VERSION ||
+        header->slot_offset + (size_t)header->slots * header->slot_size > fb->size)
+    {
+        printf("Shared memory %s is not a compatible frame ring\n", fb->name);
+        shm_fb_close(fb);
+        return -1;
+    }
+
+    atomic_thread_fence(memory_order_acquire);
+    fb->frame = atomic_load_explicit(&fb->header->latest, memory_order_acquire);
+    if (fb->frame)
+        fb->frame--;
+
+    return 0;
+}
+
+/**
+ * @brief Hands out the next frame without copying it
+ *
+ * Frames that were overwritten before the reader got to them are
+ * skipped and counted in frame->dropped.
+ *
+ * @param fb ring opened with shm_fb_open()
+ * @param frame receives the frame
+ * @return int 1 if a frame was handed out, 0 if there is none yet, -1 if the writer has stopped
+ */
+int shm_fb_next(struct shm_fb_s *fb, struct shm_fb_frame_s *frame)
+{
+    struct shm_fb_header_s *header = fb->header;
+    uint64_t last = fb->frame; // Last frame handed out, drops count from it
+
+    while (true)
+    {
+        uint64_t latest = atomic_load_explicit(&header->latest, memory_order_acquire);
+
+        if (latest <= fb->frame)
+            return atomic_load_explicit(&header->closed, memory_order_acquire) ? -1 : 0;
+
+        uint64_t next = fb->frame + 1;
+        if (latest - next >= header->slots)
+            // Lapped by the writer, continue with the oldest frame still in the ring
+            next = latest - header->slots + 1;
+
+        struct shm_fb_slot_s *slot = shm_fb_slot(header, next);
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) != next * 2)
+        {
+            // Overwritten since latest was read
+            fb->frame = next;
+            continue;
+        }
+
+        frame->number = next;
+        frame->clock = slot->clock;
+        frame->dropped = next - last - 1;
+        frame->pixels = (const uint8_t *)(slot + 1);
+        fb->frame = next;
+        return 1;
+    }
+}
+
+/**
+ * @brief Finishes working on a frame
+ *
+ * @param fb ring opened with shm_fb_open()
+ * @param frame frame handed out by shm_fb_next()
+ * @return true if the frame stayed intact, false if it was overwritten while in use
+ */
+bool shm_fb_release(struct shm_fb_s *fb, const struct shm_fb_frame_s *frame)
+{
+    struct shm_fb_slot_s *slot = shm_fb_slot(fb->header, frame->number);
+
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&slot->seq, memory_order_relaxed) == frame->number * 2;
+}
+
+/**
+ * @brief Unmaps a ring
+ *
+ * The writer marks it closed and removes the name; readers that still
+ * have it mapped can read the remaining frames.
+ *
+ * @param fb ring
+ */
+void shm_fb_close(struct shm_fb_s *fb)
+{
+    if (!fb->header)
+        return;
+
+    if (fb->owner)
+    {
+        atomic_store_explicit(&fb->header->closed, true, memory_order_release);
+        shm_unlink(fb->name);
+    }
+
+    munmap(fb->header, fb->size);
+    fb->header = NULL;
+}
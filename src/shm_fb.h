@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SHM_FB_MAGIC 0x4E59414E // "NYAN"
+#define SHM_FB_VERSION 1
+#define SHM_FB_SLOTS 8 // Default ring size
+#define SHM_FB_ALIGN 64
+
+/* Shared ring header, at the start of the mapping */
+struct shm_fb_header_s
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;       // Frame width in pixels
+    uint32_t height;      // Frame height in pixels
+    uint32_t slots;       // Frames in the ring
+    uint32_t slot_size;   // Bytes per slot, including its header
+    uint32_t slot_offset; // Offset of the first slot from the start of the mapping
+    uint32_t writer_pid;
+    atomic_uint_least64_t latest; // Number of the last complete frame, 0 before the first one
+    atomic_bool closed;           // The writer has stopped
+};
+
+/* Header of a ring slot, followed by width * height shades (0-3) */
+struct shm_fb_slot_s
+{
+    atomic_uint_least64_t seq; // Twice the frame number, odd while the frame is being written
+    uint64_t clock;            // Emulated clock at the end of the frame
+};
+
+/* Frame handed out by shm_fb_next(), valid until shm_fb_release() */
+struct shm_fb_frame_s
+{
+    uint64_t number;       // Frame number, starting at 1
+    uint64_t clock;        // Emulated clock at the end of the frame
+    uint64_t dropped;      // Frames overwritten before they could be read
+    const uint8_t *pixels; // Shades, points into the shared ring
+};
+
+/* Writer or reader side of a ring */
+struct shm_fb_s
+{
+    struct shm_fb_header_s *header;
+    size_t size;    // Size of the mapping
+    char name[64];  // Shared memory object name
+    bool owner;     // Created by this process, unlinked on close
+    uint64_t frame; // Writer: last frame published, reader: last frame handed out
+};
+
+// Writer
+int shm_fb_create(struct shm_fb_s *fb, const char *name, uint32_t width, uint32_t height, uint32_t slots);
+void shm_fb_publish(struct shm_fb_s *fb, const uint8_t *pixels, uint64_t clock);
+
+// Reader
+int shm_fb_open(struct shm_fb_s *fb, const char *name);
+int shm_fb_next(struct shm_fb_s *fb, struct shm_fb_frame_s *frame);
+bool shm_fb_release(struct shm_fb_s *fb, const struct shm_fb_frame_s *frame);
+
+void shm_fb_close(struct shm_fb_s *fb);
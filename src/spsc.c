@@ -0,0 +1,150 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "spsc.h"
+
+/**
+ * @brief Allocates a queue
+ *
+ * @param q queue
+ * @param elem_size size of an element in bytes
+ * @param capacity number of elements, rounded up to a power of two
+ * @return int 0 on success
+ */
+int spsc_init(struct spsc_s *q, size_t elem_size, size_t capacity)
+{
+    size_t size = 1;
+    while (size < capacity)
+        size <<= 1;
+
+    q->data = malloc(size * elem_size);
+    if (!q->data)
+        return -1;
+
+    q->elem_size = elem_size;
+    q->mask = size - 1;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+
+    return 0;
+}
+
+void spsc_free(struct spsc_s *q)
+{
+    free(q->data);
+    q->data = NULL;
+}
+
+/**
+ * @brief Appends an element, producer only
+ *
+ * @param q queue
+ * @param elem element to copy into the queue
+ * @return true on success, false if the queue is full
+ */
+bool spsc_push(struct spsc_s *q, const void *elem)
+{
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+    if (tail - atomic_load_explicit(&q->head, memory_order_acquire) > q->mask)
+        return false;
+
+    memcpy(&q->data[(tail & q->mask) * q->elem_size], elem, q->elem_size);
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+
+    return true;
+}
+
+/**
+ * @brief Removes the oldest element, consumer only
+ *
+ * @param q queue
+ * @param elem receives the element
+ * @return true on success, false if the queue is empty
+ */
+bool spsc_pop(struct spsc_s *q, void *elem)
+{
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+
+    if (head == atomic_load_explicit(&q->tail, memory_order_acquire))
+        return false;
+
+    memcpy(elem, &q->data[(head & q->mask) * q->elem_size], q->elem_size);
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+
+    return true;
+}
+
+/**
+ * @brief Appends as many elements as fit, producer only
+ *
+ * Publishes them all at once, so the consumer sees one index update
+ * instead of one per element.
+ *
+ * @param q queue
+ * @param elems elements to copy into the queue
+ * @param count number of elements
+ * @return size_t elements appended
+ */
+size_t spsc_push_n(struct spsc_s *q, const void *elems, size_t count)
+{
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    size_t space = q->mask + 1 - (tail - atomic_load_explicit(&q->head, memory_order_acquire));
+
+    if (count > space)
+        count = space;
+
+    // Up to the end of the storage, then from its start
+    size_t index = tail & q->mask;
+    size_t first = q->mask + 1 - index < count ? q->mask + 1 - index : count;
+
+    memcpy(&q->data[index * q->elem_size], elems, first * q->elem_size);
+    memcpy(q->data, (const uint8_t *)elems + first * q->elem_size, (count - first) * q->elem_size);
+    atomic_store_explicit(&q->tail, tail + count, memory_order_release);
+
+    return count;
+}
+
+/**
+ * @brief Removes up to count of the oldest elements, consumer only
+ *
+ * @param q queue
+ * @param elems receives the elements
+ * @param count maximum number of elements
+ * @return size_t elements removed
+ */
+size_t spsc_pop_n(struct spsc_s *q, void *elems, size_t count)
+{
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t queued = atomic_load_explicit(&q->tail, memory_order_acquire) - head;
+
+    if (count > queued)
+        count = queued;
+
+    size_t index = head & q->mask;
+    size_t first = q->mask + 1 - index < count ? q->mask + 1 - index : count;
+
+    memcpy(elems, &q->data[index * q->elem_size], first * q->elem_size);
+    memcpy((uint8_t *)elems + first * q->elem_size, q->data, (count - first) * q->elem_size);
+    atomic_store_explicit(&q->head, head + count, memory_order_release);
+
+    return count;
+}
+
+/**
+ * @brief Returns the number of queued elements
+ *
+ * Only a snapshot, the other thread may change it right away.
+ *
+ * @param q queue
+ * @return size_t number of elements
+ */
+size_t spsc_count(struct spsc_s *q)
+{
+    // Head first, the tail can only be ahead of it
+    size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+
+    return atomic_load_explicit(&q->tail, memory_order_acquire) - head;
+}
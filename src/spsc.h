@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Lock-free ring of fixed size elements, one producer and one consumer thread */
+struct spsc_s
+{
+    uint8_t *data;
+    size_t elem_size;
+    size_t mask;        // Capacity - 1, capacity is a power of two
+    atomic_size_t head; // Next element to pop, written by the consumer
+    atomic_size_t tail; // Next element to push, written by the producer
+};
+
+int spsc_init(struct spsc_s *q, size_t elem_size, size_t capacity);
+void spsc_free(struct spsc_s *q);
+bool spsc_push(struct spsc_s *q, const void *elem);
+bool spsc_pop(struct spsc_s *q, void *elem);
+size_t spsc_push_n(struct spsc_s *q, const void *elems, size_t count);
+size_t spsc_pop_n(struct spsc_s *q, void *elems, size_t count);
+size_t spsc_count(struct spsc_s *q);
@@ -4,6 +4,8 @@
 #include <stdbool.h>
 #include "gb.h"
 #include "cpu.h"
+#include "sched.h"
+#include "timer.h"
 
 static uint16_t timer_get_divider(struct gb_s *gb)
 {
@@ -30,34 +32,30 @@ static uint16_t timer_get_divider(struct gb_s *gb)
     }
 }
 
-void timer_run(struct gb_s *gb, uint16_t m_cycles)
+void timer_run(struct gb_s *gb, uint32_t m_cycles)
 {
-    static uint32_t div_cycles = 0;
-    static uint32_t timer_cycles = 0;
-    uint16_t t_cycles = m_cycles * 4;
+    struct timer_s *timer = &gb->timer;
+    uint32_t t_cycles = m_cycles * 4;
 
-    div_cycles += t_cycles;
-    if (div_cycles >= GB_DIV_CYCLES)
-    {
-        // Since we're not cycle accurate, we may have already executed
-        // some (machine) cycles that belong to the next DIV cycle, so we don't set
-        // the cycles to 0, but to the difference instead
-        div_cycles -= GB_DIV_CYCLES;
-
-        // Use direct memory write instead of mem_write_byte() because
-        // writing any value to DIV must reset it - which is not what we want here
-        gb->memory.ram[GB_DIV - 0x8000]++;
-    }
+    // Since we're not cycle accurate, we may have already executed
+    // some (machine) cycles that belong to the next DIV cycle, so we don't set
+    // the cycles to 0, but keep the difference instead.
+    // Use direct memory write instead of mem_write_byte() because
+    // writing any value to DIV must reset it - which is not what we want here
+    timer->div_cycles += t_cycles;
+    gb->memory.ram[GB_DIV - 0x8000] += timer->div_cycles / GB_DIV_CYCLES;
+    timer->div_cycles %= GB_DIV_CYCLES;
 
     if (mem_read_byte(gb, GB_TAC) & (1 << 2)) // TAC bit 2 enables the timer
     {
         uint16_t timer_target = timer_get_divider(gb);
-        timer_cycles += t_cycles;
+        timer->timer_cycles += t_cycles;
 
-        if (timer_cycles >= timer_target)
+        // Several increments are only due after a skipped HALT
+        while (timer->timer_cycles >= timer_target)
         {
             // See comment for DIV above as to why we're not resetting to 0
-            timer_cycles -= timer_target;
+            timer->timer_cycles -= timer_target;
 
             uint8_t timer_counter = mem_read_byte(gb, GB_TIMA);
             mem_write_byte(gb, GB_TIMA, timer_counter + 1);
@@ -72,4 +70,28 @@ void timer_run(struct gb_s *gb, uint16_t m_cycles)
             }
         }
     }
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Returns when TIMA overflows next
+ *
+ * @param gb gameboy state struct
+ * @return uint64_t T-cycle timestamp of the next timer interrupt, SCHED_NEVER if the timer is off
+ */
+uint64_t timer_next_overflow(struct gb_s *gb)
+{
+    if (!(mem_read_byte(gb, GB_TAC) & (1 << 2)))
+        return SCHED_NEVER;
+
+    uint16_t timer_target = timer_get_divider(gb);
+    uint32_t increments = 0x100 - mem_read_byte(gb, GB_TIMA);
+
+    uint64_t cycles = (increments - 1) * timer_target;
+
+    // If TAC was switched to a faster clock, the next increment is due right away
+    if (gb->timer.timer_cycles < timer_target)
+        cycles += timer_target - gb->timer.timer_cycles;
+
+    // The timer runs at CPU speed
+    return gb->clock + (cycles >> gb->double_speed);
+}
@@ -1,5 +1,15 @@
 #pragma once
 
-#include "gb.h"
+#include <stdint.h>
 
-void timer_run(struct gb_s *gb, uint16_t m_cycles);
\ No newline at end of file
+/* Timer state */
+struct timer_s
+{
+    uint32_t div_cycles;   // T-cycles since the last DIV increment
+    uint32_t timer_cycles; // T-cycles since the last TIMA increment
+};
+
+struct gb_s;
+
+void timer_run(struct gb_s *gb, uint32_t m_cycles);
+uint64_t timer_next_overflow(struct gb_s *gb);
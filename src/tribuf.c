@@ -0,0 +1,75 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "tribuf.h"
+
+/*
+ * Triple buffer
+ *
+ * The writer always owns one buffer and the reader another, the third
+ * one is exchanged between them with a single atomic swap. Neither side
+ * ever waits: the writer overwrites a frame the reader did not pick up,
+ * the reader keeps its current buffer until a new one is published.
+ */
+
+#define TRIBUF_INDEX 0x3
+#define TRIBUF_FRESH 0x4
+
+int tribuf_init(struct tribuf_s *tb, size_t size)
+{
+    uint8_t *mem = calloc(3, size);
+    if (!mem)
+        return -1;
+
+    for (int i = 0; i < 3; i++)
+    {
+        tb->buffers[i] = mem + i * size;
+    }
+
+    tb->size = size;
+    tb->back = 0;
+    atomic_init(&tb->middle, 1);
+    tb->front = 2;
+
+    return 0;
+}
+
+void tribuf_free(struct tribuf_s *tb)
+{
+    free(tb->buffers[0]);
+}
+
+/**
+ * @brief Hands the back buffer to the reader
+ *
+ * Called by the writer after filling tribuf_back(), which points to a
+ * different buffer afterwards.
+ *
+ * @param tb triple buffer
+ */
+void tribuf_publish(struct tribuf_s *tb)
+{
+    unsigned old = atomic_exchange_explicit(&tb->middle, tb->back | TRIBUF_FRESH, memory_order_acq_rel);
+    tb->back = old & TRIBUF_INDEX;
+}
+
+/**
+ * @brief Picks up the latest published buffer
+ *
+ * Called by the reader, tribuf_front() points to the new buffer
+ * afterwards.
+ *
+ * @param tb triple buffer
+ * @return true if a new buffer was published since the last call
+ */
+bool tribuf_acquire(struct tribuf_s *tb)
+{
+    if (!(atomic_load_explicit(&tb->middle, memory_order_relaxed) & TRIBUF_FRESH))
+        return false;
+
+    unsigned old = atomic_exchange_explicit(&tb->middle, tb->front, memory_order_acq_rel);
+    tb->front = old & TRIBUF_INDEX;
+
+    return true;
+}
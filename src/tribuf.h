@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Lock-free triple buffer, one writer and one reader thread */
+struct tribuf_s
+{
+    uint8_t *buffers[3];
+    size_t size;
+    unsigned back;      // Being written, writer only
+    unsigned front;     // Being read, reader only
+    atomic_uint middle; // Last published buffer, TRIBUF_FRESH if not picked up yet
+};
+
+int tribuf_init(struct tribuf_s *tb, size_t size);
+void tribuf_free(struct tribuf_s *tb);
+void tribuf_publish(struct tribuf_s *tb);
+bool tribuf_acquire(struct tribuf_s *tb);
+
+/* Buffer the writer fills next */
+static inline uint8_t *tribuf_back(struct tribuf_s *tb)
+{
+    return tb->buffers[tb->back];
+}
+
+/* Latest buffer picked up by the reader */
+static inline const uint8_t *tribuf_front(const struct tribuf_s *tb)
+{
+    return tb->buffers[tb->front];
+}
@@ -0,0 +1,234 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "ppu.h"
+#include "video.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/*
+ * Frame conversion
+ *
+ * The PPU only stores one shade (0-3) per pixel. Converting to host
+ * pixels is done here, on demand, for frames that are actually
+ * consumed. Each row is converted 16 pixels at a time with SSE2 or NEON
+ * where available: every shade is compared against the row and the
+ * matching lookup table value is blended in.
+ */
+
+/* Default DMG shades, white to black */
+static const uint32_t video_default_colors[VIDEO_NUM_SHADES] = {0xFFFFFFFF, 0xAAAAAAFF, 0x555555FF, 0x000000FF};
+
+/**
+ * @brief Precomputes the lookup tables for all formats
+ *
+ * @param palette palette to initialize
+ * @param colors 0xRRGGBBAA color per shade, NULL for the default grays
+ */
+void video_palette_init(struct video_palette_s *palette, const uint32_t colors[VIDEO_NUM_SHADES])
+{
+    if (!colors)
+        colors = video_default_colors;
+
+    for (int shade = 0; shade < VIDEO_NUM_SHADES; shade++)
+    {
+        uint8_t r = colors[shade] >> 24;
+        uint8_t g = colors[shade] >> 16;
+        uint8_t b = colors[shade] >> 8;
+
+        palette->rgba8888[shade] = colors[shade];
+        palette->rgb565[shade] = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+        // ITU-R BT.601 luma
+        palette->gray8[shade] = (r * 299 + g * 587 + b * 114) / 1000;
+    }
+}
+
+size_t video_format_bpp(video_format_t format)
+{
+    switch (format)
+    {
+    case VIDEO_FORMAT_RGBA8888:
+        return 4;
+    case VIDEO_FORMAT_RGB565:
+        return 2;
+    default:
+        return 1;
+    }
+}
+
+static void video_convert_rgba8888(const struct video_palette_s *palette, const uint8_t *src, uint32_t *dst)
+{
+    int x = 0;
+
+#if defined(__SSE2__)
+    __m128i lut[VIDEO_NUM_SHADES];
+    for (int shade = 0; shade < VIDEO_NUM_SHADES; shade++)
+        lut[shade] = _mm_set1_epi32(palette->rgba8888[shade]);
+
+    for (; x + 16 <= GB_LCD_WIDTH; x += 16)
+    {
+        __m128i zero = _mm_setzero_si128();
+        __m128i in = _mm_loadu_si128((const __m128i *)&src[x]);
+        __m128i lo = _mm_unpacklo_epi8(in, zero);
+        __m128i hi = _mm_unpackhi_epi8(in, zero);
+        __m128i idx[4] = {_mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+                          _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero)};
+
+        for (int i = 0; i < 4; i++)
+        {
+            __m128i out = zero;
+            for (int shade = 0; shade < VIDEO_NUM_SHADES; shade++)
+            {
+                __m128i mask = _mm_cmpeq_epi32(idx[i], _mm_set1_epi32(shade));
+                out = _mm_or_si128(out, _mm_and_si128(mask, lut[shade]));
+            }
+            _mm_storeu_si128((__m128i *)&dst[x + i * 4], out);
+        }
+    }
+#elif defined(__ARM_NEON)
+    for (; x + 16 <= GB_LCD_WIDTH; x += 16)
+    {
+        uint8x16_t in = vld1q_u8(&src[x]);
+        uint8x16x4_t out;
+
+        // One table lookup per byte of the output pixels
+        for (int byte = 0; byte < 4; byte++)
+        {
+            uint8_t table[8] = {0};
+            for (int shade = 0; shade < VIDEO_NUM_SHADES; shade++)
+                table[shade] = palette->rgba8888[shade] >> (byte * 8);
+
+            uint8x8_t tbl = vld1_u8(table);
+            out.val[byte] = vcombine_u8(vtbl1_u8(tbl, vget_low_u8(in)), vtbl1_u8(tbl, vget_high_u8(in)));
+        }
+
+        vst4q_u8((uint8_t *)&dst[x], out);
+    }
+#endif
+
+    for (; x < GB_LCD_WIDTH; x++)
+        dst[x] = palette->rgba8888[src[x] & 0b11];
+}
+
+static void video_convert_rgb565(const struct video_palette_s *palette, const uint8_t *src, uint16_t *dst)
+{
+    int x = 0;
+
+#if defined(__SSE2__)
+    __m128i lut[VIDEO_NUM_SHADES];
+    for (int shade = 0; shade < VIDEO_NUM_SHADES; shade++)
+        lut[shade] = _mm_set1_epi16(palette->rgb565[shade]);
+
+    for (; x + 16 <= GB_LCD_WIDTH; x += 16)
+    {
+        __m128i zero = _mm_setzero_si128();
+        __m128i in = _mm_loadu_si128((const __m128i *)&src[x]);
+        __m128i idx[2] = {_mm_unpacklo_epi8(in, zero), _mm_unpackhi_epi8(in, zero)};
+
+        for (int i = 0; i < 2; i++)
+        {
+            __m128i out = zero;
+            for (int shade = 0; shade < VIDEO_NUM_SHADES; shade++)
+            {
+                __m128i mask = _mm_cmpeq_epi16(idx[i], _mm_set1_epi16(shade));
+                out = _mm_or_si128(out, _mm_and_si128(mask, lut[shade]));
+            }
+            _mm_storeu_si128((__m128i *)&dst[x + i * 8], out);
+        }
+    }
+#elif defined(__ARM_NEON)
+    uint8_t table_lo[8] = {0};
+    uint8_t table_hi[8] = {0};
+    for (int shade = 0; shade < VIDEO_NUM_SHADES; shade++)
+    {
+        table_lo[shade] = palette->rgb565[shade] & 0xFF;
+        table_hi[shade] = palette->rgb565[shade] >> 8;
+    }
+    uint8x8_t tbl_lo = vld1_u8(table_lo);
+    uint8x8_t tbl_hi = vld1_u8(table_hi);
+
+    for (; x + 16 <= GB_LCD_WIDTH; x += 16)
+    {
+        uint8x16_t in = vld1q_u8(&src[x]);
+        uint8x16x2_t out;
+
+        out.val[0] = vcombine_u8(vtbl1_u8(tbl_lo, vget_low_u8(in)), vtbl1_u8(tbl_lo, vget_high_u8(in)));
+        out.val[1] = vcombine_u8(vtbl1_u8(tbl_hi, vget_low_u8(in)), vtbl1_u8(tbl_hi, vget_high_u8(in)));
+        vst2q_u8((uint8_t *)&dst[x], out);
+    }
+#endif
+
+    for (; x < GB_LCD_WIDTH; x++)
+        dst[x] = palette->rgb565[src[x] & 0b11];
+}
+
+static void video_convert_gray8(const struct video_palette_s *palette, const uint8_t *src, uint8_t *dst)
+{
+    int x = 0;
+
+#if defined(__SSE2__)
+    for (; x + 16 <= GB_LCD_WIDTH; x += 16)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i *)&src[x]);
+        __m128i out = _mm_setzero_si128();
+
+        for (int shade = 0; shade < VIDEO_NUM_SHADES; shade++)
+        {
+            __m128i mask = _mm_cmpeq_epi8(in, _mm_set1_epi8(shade));
+            out = _mm_or_si128(out, _mm_and_si128(mask, _mm_set1_epi8(palette->gray8[shade])));
+        }
+        _mm_storeu_si128((__m128i *)&dst[x], out);
+    }
+#elif defined(__ARM_NEON)
+    uint8_t table[8] = {0};
+    memcpy(table, palette->gray8, VIDEO_NUM_SHADES);
+    uint8x8_t tbl = vld1_u8(table);
+
+    for (; x + 16 <= GB_LCD_WIDTH; x += 16)
+    {
+        uint8x16_t in = vld1q_u8(&src[x]);
+        vst1q_u8(&dst[x], vcombine_u8(vtbl1_u8(tbl, vget_low_u8(in)), vtbl1_u8(tbl, vget_high_u8(in))));
+    }
+#endif
+
+    for (; x < GB_LCD_WIDTH; x++)
+        dst[x] = palette->gray8[src[x] & 0b11];
+}
+
+/**
+ * @brief Converts a frame of shades to host pixels
+ *
+ * @param palette lookup tables
+ * @param format host pixel format
+ * @param src 160x144 shades, as returned by ppu_framebuffer()
+ * @param dst destination pixels
+ * @param pitch bytes per destination row
+ */
+void video_convert(const struct video_palette_s *palette, video_format_t format,
+                   const uint8_t *src, void *dst, size_t pitch)
+{
+    for (int y = 0; y < GB_LCD_HEIGHT; y++)
+    {
+        const uint8_t *in = &src[y * GB_LCD_WIDTH];
+        uint8_t *out = (uint8_t *)dst + y * pitch;
+
+        switch (format)
+        {
+        case VIDEO_FORMAT_RGBA8888:
+            video_convert_rgba8888(palette, in, (uint32_t *)out);
+            break;
+
+        case VIDEO_FORMAT_RGB565:
+            video_convert_rgb565(palette, in, (uint16_t *)out);
+            break;
+
+        case VIDEO_FORMAT_GRAY8:
+            video_convert_gray8(palette, in, out);
+            break;
+        }
+    }
+}
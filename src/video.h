@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define VIDEO_NUM_SHADES 4
+
+/* Host pixel formats */
+typedef enum video_format
+{
+    VIDEO_FORMAT_RGBA8888, // 32-bit 0xRRGGBBAA
+    VIDEO_FORMAT_RGB565,   // 16-bit
+    VIDEO_FORMAT_GRAY8     // 8-bit luminance
+} video_format_t;
+
+/* Shade to host pixel lookup tables, shared by all instances */
+struct video_palette_s
+{
+    uint32_t rgba8888[VIDEO_NUM_SHADES];
+    uint16_t rgb565[VIDEO_NUM_SHADES];
+    uint8_t gray8[VIDEO_NUM_SHADES];
+};
+
+void video_palette_init(struct video_palette_s *palette, const uint32_t colors[VIDEO_NUM_SHADES]);
+void video_convert(const struct video_palette_s *palette, video_format_t format,
+                   const uint8_t *src, void *dst, size_t pitch);
+size_t video_format_bpp(video_format_t format);
@@ -0,0 +1,238 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "spsc.h"
+#include "wav_out.h"
+
+/*
+ * WAV capture
+ *
+ * The emulation queues samples into a large lock-free ring and returns
+ * right away; a writer thread converts them to little endian, hashes
+ * and writes them in big chunks. Disk I/O only holds up the emulation
+ * when the writer falls a whole buffer behind, which is counted as a
+ * stall. The hash covers exactly the bytes of the data chunk, so a
+ * file can be checked against it later, and runs can be compared with
+ * golden values without keeping the files.
+ */
+
+#define WAV_OUT_HEADER_SIZE 44
+#define WAV_OUT_FNV_OFFSET 0xCBF29CE484222325ull
+#define WAV_OUT_FNV_PRIME 0x100000001B3ull
+
+static void wav_out_put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void wav_out_put32(uint8_t *p, uint32_t v)
+{
+    wav_out_put16(p, v);
+    wav_out_put16(p + 2, v >> 16);
+}
+
+/**
+ * @brief Writes the RIFF header
+ *
+ * @param w WAV output state
+ * @param data_size size of the sample data in bytes, saturated to 32 bits
+ * @return true on success
+ */
+static bool wav_out_header(struct wav_out_s *w, uint64_t data_size)
+{
+    uint8_t header[WAV_OUT_HEADER_SIZE];
+    uint32_t size = data_size > UINT32_MAX - WAV_OUT_HEADER_SIZE ? UINT32_MAX - WAV_OUT_HEADER_SIZE : data_size;
+
+    memcpy(header, "RIFF", 4);
+    wav_out_put32(&header[4], size + WAV_OUT_HEADER_SIZE - 8);
+    memcpy(&header[8], "WAVEfmt ", 8);
+    wav_out_put32(&header[16], 16);          // Format chunk size
+    wav_out_put16(&header[20], 1);           // PCM
+    wav_out_put16(&header[22], 2);           // Channels
+    wav_out_put32(&header[24], w->rate);     // Samples per second
+    wav_out_put32(&header[28], w->rate * 4); // Bytes per second
+    wav_out_put16(&header[32], 4);           // Bytes per stereo sample
+    wav_out_put16(&header[34], 16);          // Bits per sample
+    memcpy(&header[36], "data", 4);
+    wav_out_put32(&header[40], size);
+
+    return fwrite(header, sizeof(header), 1, w->file) == 1;
+}
+
+/**
+ * @brief Writes out everything queued
+ *
+ * @param w WAV output state
+ */
+static void wav_out_drain(struct wav_out_s *w)
+{
+    int16_t chunk[WAV_OUT_CHUNK * 2];
+    uint8_t bytes[WAV_OUT_CHUNK * 4];
+    size_t count;
+
+    while ((count = spsc_pop_n(&w->ring, chunk, WAV_OUT_CHUNK)) > 0)
+    {
+        uint64_t hash = w->hash;
+
+        for (size_t i = 0; i < count * 2; i++)
+        {
+            wav_out_put16(&bytes[i * 2], chunk[i]);
+            hash = (hash ^ bytes[i * 2]) * WAV_OUT_FNV_PRIME;
+            hash = (hash ^ bytes[i * 2 + 1]) * WAV_OUT_FNV_PRIME;
+        }
+
+        w->hash = hash;
+        w->samples += count;
+
+        if (!w->failed && fwrite(bytes, 4, count, w->file) != count)
+        {
+            printf("Could not write WAV file\n");
+            w->failed = true;
+        }
+    }
+}
+
+static void *wav_out_main(void *arg)
+{
+    struct wav_out_s *w = arg;
+
+    pthread_mutex_lock(&w->lock);
+
+    while (true)
+    {
+        while (!w->pending && !w->quit)
+            pthread_cond_wait(&w->cond, &w->lock);
+
+        bool quit = w->quit;
+        w->pending = false;
+        pthread_mutex_unlock(&w->lock);
+
+        wav_out_drain(w);
+
+        if (quit)
+            return NULL;
+
+        pthread_mutex_lock(&w->lock);
+    }
+}
+
+/**
+ * @brief Wakes the writer
+ *
+ * @param w WAV output state
+ */
+static void wav_out_kick(struct wav_out_s *w)
+{
+    pthread_mutex_lock(&w->lock);
+    w->pending = true;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    w->queued = 0;
+}
+
+/**
+ * @brief Creates a WAV file and starts its writer
+ *
+ * @param w WAV output state
+ * @param path file to create
+ * @param rate sample rate in Hz
+ * @return int 0 on success
+ */
+int wav_out_open(struct wav_out_s *w, const char *path, uint32_t rate)
+{
+    memset(w, 0, sizeof(*w));
+    w->rate = rate;
+    w->hash = WAV_OUT_FNV_OFFSET;
+    atomic_init(&w->stalls, 0);
+
+    w->file = fopen(path, "wb");
+    if (!w->file)
+    {
+        printf("Could not create %s\n", path);
+        return -1;
+    }
+
+    // Sizes are filled in on close
+    if (!wav_out_header(w, 0) || spsc_init(&w->ring, 2 * sizeof(int16_t), WAV_OUT_BUFFER) != 0)
+    {
+        printf("Could not set up WAV output\n");
+        fclose(w->file);
+        return -1;
+    }
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+
+    if (pthread_create(&w->thread, NULL, wav_out_main, w) != 0)
+    {
+        printf("Could not start WAV writer\n");
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+        spsc_free(&w->ring);
+        fclose(w->file);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Queues samples, only waits if the writer is a whole buffer behind
+ *
+ * @param w WAV output state
+ * @param samples interleaved left/right samples
+ * @param count number of stereo samples
+ */
+void wav_out_write(struct wav_out_s *w, const int16_t *samples, uint32_t count)
+{
+    while (count)
+    {
+        uint32_t pushed = spsc_push_n(&w->ring, samples, count);
+
+        samples += pushed * 2;
+        count -= pushed;
+        w->queued += pushed;
+
+        if (w->queued >= WAV_OUT_CHUNK || count)
+            wav_out_kick(w);
+
+        if (count)
+        {
+            atomic_fetch_add_explicit(&w->stalls, 1, memory_order_relaxed);
+            nanosleep(&(struct timespec){.tv_nsec = 1000000}, NULL);
+        }
+    }
+}
+
+/**
+ * @brief Writes out the remaining samples and completes the file
+ *
+ * @param w WAV output state
+ * @return int 0 on success, -1 if the file is incomplete
+ */
+int wav_out_close(struct wav_out_s *w)
+{
+    pthread_mutex_lock(&w->lock);
+    w->quit = true;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+    spsc_free(&w->ring);
+
+    // Not possible on pipes, the sizes stay 0 then like for a live stream
+    if (!w->failed && fseek(w->file, 0, SEEK_SET) == 0 && !wav_out_header(w, w->samples * 4))
+        w->failed = true;
+
+    if (fclose(w->file) != 0)
+        w->failed = true;
+
+    return w->failed ? -1 : 0;
+}
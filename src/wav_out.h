@@ -0,0 +1,37 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "spsc.h"
+
+#define WAV_OUT_BUFFER (1 << 20) // Stereo samples buffered, about 22 s at 48 kHz
+#define WAV_OUT_CHUNK 16384      // Stereo samples per disk write, the writer is woken once this many are queued
+
+/* WAV file written on a background thread */
+struct wav_out_s
+{
+    FILE *file;
+    uint32_t rate;
+    uint32_t queued;    // Samples queued since the writer was last woken, producer only
+    struct spsc_s ring; // Interleaved stereo samples, to the writer
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool pending; // Samples were queued
+    bool quit;
+
+    // Writer only until it was joined
+    uint64_t samples; // Stereo samples written
+    uint64_t hash;    // FNV-1a of the data chunk
+    bool failed;      // A write failed, the file is incomplete
+
+    atomic_uint_fast32_t stalls; // Times the emulation waited for the writer
+};
+
+int wav_out_open(struct wav_out_s *w, const char *path, uint32_t rate);
+void wav_out_write(struct wav_out_s *w, const int16_t *samples, uint32_t count);
+int wav_out_close(struct wav_out_s *w);
@@ -0,0 +1,673 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SDL.h"
+#include "apu.h"
+#include "audio_out.h"
+#include "blip.h"
+#include "gb.h"
+#include "joypad.h"
+#include "post.h"
+#include "ppu.h"
+#include "shm_fb.h"
+#include "spsc.h"
+#include "tribuf.h"
+#include "video.h"
+#include "window.h"
+
+/*
+ * SDL frontend
+ *
+ * The emulation runs on its own thread, paced to the native frame rate,
+ * and publishes finished frames through a triple buffer. A worker
+ * converts them and runs the post-processing chain (see post.c), then
+ * hands them on through another triple buffer. The main thread only
+ * handles SDL: it polls events, forwards input through a queue, copies
+ * the latest processed frame into a streaming texture and presents it.
+ * Key events go straight into the joypad queue, which the emulation
+ * drains when the game reads the joypad.
+ *
+ * With run-ahead, every frame is followed by a few speculative ones with
+ * the same input, and the last of them is shown (see gb_run_ahead()).
+ * A slow compositor or a blocking present therefore never stalls the
+ * emulation.
+ *
+ * The APU's samples are handed to the audio output once per emulated
+ * frame. Dynamic rate control adjusts the APU output rate to keep the
+ * audio buffer at the target latency while the emulation follows the
+ * frame timer.
+ *
+ * Speed can be switched at runtime: 1-4 run at that multiple of the
+ * native speed, 0 uncaps it, and holding Tab uncaps it temporarily.
+ * F1-F4 toggle the post-processing stages.
+ */
+
+#define WINDOW_SCALE 3
+#define INPUT_QUEUE_SIZE 64
+#define SPEED_UNCAPPED 0
+
+/* Emulation thread state */
+struct window_emu_s
+{
+    struct gb_s *gb;
+    const struct window_opts_s *opts;
+    pthread_t thread;
+    atomic_bool quit;
+
+    struct tribuf_s frames;   // Shades of finished frames, to the post-processing worker
+    struct post_s post;       // Post-processing worker, publishes to the main thread
+    struct spsc_s input;      // struct joypad_event_s, from the main thread
+    struct gb_s *snapshot;    // Scratch state for run-ahead
+    struct audio_out_s audio; // Audio output, device is 0 without audio
+    struct audio_frame_s samples[BLIP_SIZE]; // Scratch for the APU output of a frame
+
+    atomic_uint speed;     // Multiple of the native speed, SPEED_UNCAPPED for no limit
+    unsigned base_speed;   // Speed to return to after fast-forwarding, main thread only
+    unsigned skipped;      // Frames skipped in a row, emulation thread only
+
+    atomic_uint_fast64_t emu_ticks; // Time spent emulating since the last report
+    atomic_uint_fast32_t emu_frames;
+    atomic_uint_fast64_t clock;        // Copy of the emulated clock, for reports
+    atomic_uint_fast64_t instructions; // Copy of the instruction count, for reports
+
+    atomic_uint_fast64_t input_cycles; // Emulated time from latching input to the next frame, summed
+    atomic_uint_fast32_t input_frames; // Frames handed out with new input since the last report
+    uint64_t input_seen;               // Last input counted, emulation thread only
+};
+
+/* Main thread statistics since the last report, in performance counter ticks */
+struct frame_stats_s
+{
+    uint64_t start;   // Start of the interval
+    uint64_t clock;   // Emulated clock at the start of the interval
+    uint64_t instructions;
+    uint32_t underruns; // Audio counters at the start of the interval
+    uint32_t overruns;
+    uint64_t host;    // Event handling, conversion and texture upload
+    uint64_t present; // Presenting and waiting for the next frame
+    uint32_t frames;  // Frames presented
+};
+
+/**
+ * @brief Reports the time per frame of each post-processing stage
+ *
+ * @param post post-processing worker
+ */
+static void stats_report_post(struct post_s *post)
+{
+    uint32_t frames = atomic_exchange(&post->frames, 0);
+    double ms = frames ? 1.0 / (frames * 1000000.0) : 0.0;
+    unsigned enabled = atomic_load(&post->enabled);
+
+    fprintf(stderr, "Post %u frames: convert %.2f ms", frames, atomic_exchange(&post->convert_ns, 0) * ms);
+
+    for (unsigned pos = 0; pos < post->chain.count; pos++)
+    {
+        uint64_t ns = atomic_exchange(&post->stage_ns[pos], 0);
+
+        if (enabled & (1u << pos))
+            fprintf(stderr, ", %s %.2f ms", post_stage_name(post->chain.stages[pos]), ns * ms);
+        else
+            fprintf(stderr, ", %s off", post_stage_name(post->chain.stages[pos]));
+    }
+
+    fprintf(stderr, "\n");
+}
+
+/**
+ * @brief Reports emulation speed and frame timing on the console and in the window title
+ *
+ * @param stats main thread statistics, reset for the next interval
+ * @param emu emulation thread state
+ * @param window window to set the title of
+ * @param now current performance counter value
+ */
+static void stats_report(struct frame_stats_s *stats, struct window_emu_s *emu, SDL_Window *window, uint64_t now)
+{
+    uint64_t freq = SDL_GetPerformanceFrequency();
+    double ms = 1000.0 / freq;
+    double real = (double)(now - stats->start) / freq;
+    uint64_t emu_ticks = atomic_exchange(&emu->emu_ticks, 0);
+    uint32_t emu_frames = atomic_exchange(&emu->emu_frames, 0);
+    uint64_t clock = atomic_load(&emu->clock);
+    uint64_t instructions = atomic_load(&emu->instructions);
+
+    double speed = (double)(clock - stats->clock) / GB_CLOCK_SPEED_HZ / real * 100.0;
+    double mips = (double)(instructions - stats->instructions) / real / 1000000.0;
+    double fps = stats->frames / real;
+    char title[96];
+
+    fprintf(stderr, "Speed %.0f%%, %.2f MIPS, %.1f fps (emu %.2f ms/frame, host %.2f ms, present %.2f ms)\n",
+            speed, mips, fps, emu_frames ? emu_ticks * ms / emu_frames : 0.0,
+            stats->frames ? stats->host * ms / stats->frames : 0.0,
+            stats->frames ? stats->present * ms / stats->frames : 0.0);
+
+    if (emu->post.chain.count)
+        stats_report_post(&emu->post);
+
+    uint32_t input_frames = atomic_exchange(&emu->input_frames, 0);
+    uint64_t input_cycles = atomic_exchange(&emu->input_cycles, 0);
+    if (input_frames)
+        fprintf(stderr, "Input %u frames, %.2f ms from latching to the frame\n", input_frames,
+                input_cycles * 1000.0 / GB_CLOCK_SPEED_HZ / input_frames);
+
+    if (emu->audio.device)
+    {
+        uint32_t underruns = atomic_load(&emu->audio.underruns);
+        uint32_t overruns = atomic_load(&emu->audio.overruns);
+
+        fprintf(stderr, "Audio %.1f ms buffered, ratio %+.3f%%, %u underruns, %u overruns\n",
+                audio_out_fill(&emu->audio) * 1000.0 / emu->audio.rate,
+                atomic_load(&emu->audio.adjust_ppm) / 1e4,
+                underruns - stats->underruns, overruns - stats->overruns);
+        stats->underruns = underruns;
+        stats->overruns = overruns;
+    }
+
+    snprintf(title, sizeof(title), "nyanGBE - %.0f%% - %.2f MIPS - %.0f fps", speed, mips, fps);
+    SDL_SetWindowTitle(window, title);
+
+    stats->host = 0;
+    stats->present = 0;
+    stats->frames = 0;
+    stats->start = now;
+    stats->clock = clock;
+    stats->instructions = instructions;
+}
+
+/**
+ * @brief Returns the whole milliseconds left until a deadline
+ *
+ * @param deadline performance counter value
+ * @return uint32_t milliseconds, 0 if less than one is left
+ */
+static uint32_t ms_until(uint64_t deadline)
+{
+    uint64_t now = SDL_GetPerformanceCounter();
+
+    if (now >= deadline)
+        return 0;
+
+    return (deadline - now) * 1000 / SDL_GetPerformanceFrequency();
+}
+
+/**
+ * @brief Sleeps until a deadline
+ *
+ * The host CPU is idle while waiting. Sleeps are rounded down to whole
+ * milliseconds, but since deadlines are absolute the remainder doesn't
+ * add up over frames.
+ *
+ * @param deadline performance counter value to wait for
+ */
+static void wait_until(uint64_t deadline)
+{
+    uint32_t ms = ms_until(deadline);
+
+    if (ms)
+        SDL_Delay(ms);
+}
+
+/**
+ * @brief Advances a frame deadline
+ *
+ * @param deadline deadline of the previous frame, updated
+ * @param frame_ticks length of a frame in performance counter ticks
+ */
+static void next_deadline(uint64_t *deadline, uint64_t frame_ticks)
+{
+    *deadline += frame_ticks;
+
+    uint64_t now = SDL_GetPerformanceCounter();
+    if (now > *deadline + frame_ticks)
+        // Too far behind to catch up, don't run frames back to back
+        *deadline = now;
+}
+
+/**
+ * @brief Counts the emulated time from the last input to a frame handed out
+ *
+ * With run-ahead this is measured to the real frame, the one shown is
+ * further ahead.
+ *
+ * @param emu emulation thread state
+ */
+static void window_input_latency(struct window_emu_s *emu)
+{
+    uint64_t input = emu->gb->joypad.last_input;
+
+    if (input == emu->input_seen)
+        return;
+
+    emu->input_seen = input;
+    atomic_fetch_add_explicit(&emu->input_cycles, emu->gb->clock - input, memory_order_relaxed);
+    atomic_fetch_add_explicit(&emu->input_frames, 1, memory_order_relaxed);
+}
+
+static void *window_emu_main(void *arg)
+{
+    struct window_emu_s *emu = arg;
+    struct gb_s *gb = emu->gb;
+    uint64_t frame_ticks = SDL_GetPerformanceFrequency() * GB_FRAME_CYCLES / GB_CLOCK_SPEED_HZ;
+    uint64_t deadline = SDL_GetPerformanceCounter();
+    uint64_t frame_end = gb->clock;
+
+    joypad_set_queue(gb, &emu->input);
+
+    while (!atomic_load_explicit(&emu->quit, memory_order_relaxed))
+    {
+        unsigned speed = atomic_load_explicit(&emu->speed, memory_order_relaxed);
+
+        // Rendering is only skipped while running uncapped
+        bool skip = speed == SPEED_UNCAPPED && emu->skipped < emu->opts->frameskip;
+        emu->skipped = skip ? emu->skipped + 1 : 0;
+        gb->ppu.skip_frame = skip;
+
+        // Sound is only output at the native speed, otherwise not even synthesized
+        apu_set_synth(gb, emu->audio.device && speed == 1);
+
+        uint64_t start = SDL_GetPerformanceCounter();
+
+        frame_end += GB_FRAME_CYCLES;
+        if (emu->snapshot)
+        {
+            if (gb_run_ahead(gb, UINT64_MAX, emu->opts->run_ahead, emu->snapshot, tribuf_back(&emu->frames)))
+            {
+                if (emu->opts->shm)
+                    shm_fb_publish(emu->opts->shm, tribuf_back(&emu->frames), gb->clock);
+                tribuf_publish(&emu->frames);
+                post_kick(&emu->post);
+                window_input_latency(emu);
+            }
+        }
+        else if (emu->opts->log_file)
+            gb_run_logged(gb, frame_end, emu->opts->log_file);
+        else
+            gb_run(gb, frame_end);
+
+        if (gb->ppu.frame_ready)
+        {
+            memcpy(tribuf_back(&emu->frames), ppu_framebuffer(gb), emu->frames.size);
+            if (emu->opts->shm)
+                shm_fb_publish(emu->opts->shm, ppu_framebuffer(gb), gb->clock);
+            tribuf_publish(&emu->frames);
+            post_kick(&emu->post);
+            window_input_latency(emu);
+            gb->ppu.frame_ready = false;
+        }
+
+        if (gb->apu.synth)
+        {
+            uint32_t count = apu_read_samples(gb, &emu->samples[0].left, BLIP_SIZE);
+
+            audio_out_write(&emu->audio, emu->samples, count);
+        }
+
+        atomic_fetch_add_explicit(&emu->emu_ticks, SDL_GetPerformanceCounter() - start, memory_order_relaxed);
+        atomic_fetch_add_explicit(&emu->emu_frames, 1, memory_order_relaxed);
+        atomic_store_explicit(&emu->clock, gb->clock, memory_order_relaxed);
+        atomic_store_explicit(&emu->instructions, gb->instructions, memory_order_relaxed);
+
+        if (speed != SPEED_UNCAPPED)
+        {
+            // Idle until the next frame is due, a mostly halted game barely uses the host CPU
+            next_deadline(&deadline, frame_ticks / speed);
+            wait_until(deadline);
+        }
+    }
+
+    joypad_set_queue(gb, NULL);
+    return NULL;
+}
+
+/**
+ * @brief Maps a host key to a joypad button
+ *
+ * @param key SDL key code
+ * @return int joypad_button_t, -1 if the key is not mapped
+ */
+static int window_key_button(int key)
+{
+    switch (key)
+    {
+    case SDLK_RIGHT:
+        return JOYPAD_RIGHT;
+    case SDLK_LEFT:
+        return JOYPAD_LEFT;
+    case SDLK_UP:
+        return JOYPAD_UP;
+    case SDLK_DOWN:
+        return JOYPAD_DOWN;
+    case SDLK_x:
+        return JOYPAD_A;
+    case SDLK_z:
+        return JOYPAD_B;
+    case SDLK_BACKSPACE:
+    case SDLK_RSHIFT:
+        return JOYPAD_SELECT;
+    case SDLK_RETURN:
+        return JOYPAD_START;
+    default:
+        return -1;
+    }
+}
+
+/**
+ * @brief Handles the speed control keys
+ *
+ * @param emu emulation thread state
+ * @param key SDL key code
+ * @param pressed true for key down events
+ * @return true if the key controls the speed
+ */
+static bool window_speed_key(struct window_emu_s *emu, int key, bool pressed)
+{
+    switch (key)
+    {
+    case SDLK_TAB:
+        // Fast-forward while held
+        atomic_store(&emu->speed, pressed ? SPEED_UNCAPPED : emu->base_speed);
+        return true;
+
+    case SDLK_0:
+    case SDLK_1:
+    case SDLK_2:
+    case SDLK_3:
+    case SDLK_4:
+        if (pressed)
+        {
+            emu->base_speed = key - SDLK_0;
+            atomic_store(&emu->speed, emu->base_speed);
+        }
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief Toggles post-processing stages with F1-F4
+ *
+ * @param emu emulation thread state
+ * @param key SDL key code
+ * @param pressed true for key down events
+ * @return true if the key controls post-processing
+ */
+static bool window_post_key(struct window_emu_s *emu, int key, bool pressed)
+{
+    if (key < SDLK_F1 || key >= SDLK_F1 + POST_MAX_STAGES)
+        return false;
+
+    unsigned pos = key - SDLK_F1;
+    if (pressed && pos < emu->post.chain.count)
+    {
+        bool on = post_toggle(&emu->post, pos);
+        fprintf(stderr, "%s %s\n", post_stage_name(emu->post.chain.stages[pos]), on ? "on" : "off");
+    }
+
+    return true;
+}
+
+/**
+ * @brief Handles an SDL event and forwards input to the emulation
+ *
+ * @param emu emulation thread state
+ * @param event event to handle
+ * @return false if the window was closed
+ */
+static bool window_handle_event(struct window_emu_s *emu, const SDL_Event *event)
+{
+    switch (event->type)
+    {
+    case SDL_QUIT:
+        return false;
+
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+    {
+        int key = event->key.keysym.sym;
+        bool pressed = event->type == SDL_KEYDOWN;
+
+        if (event->key.repeat || window_speed_key(emu, key, pressed) || window_post_key(emu, key, pressed))
+            break;
+
+        int button = window_key_button(key);
+        if (button < 0)
+            break;
+
+        struct joypad_event_s input = {.button = button, .pressed = pressed};
+        if (!spsc_push(&emu->input, &input))
+            fprintf(stderr, "Input queue full, dropping key event\n");
+        break;
+    }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Handles all pending SDL events
+ *
+ * @param emu emulation thread state
+ * @return false if the window was closed
+ */
+static bool window_poll_events(struct window_emu_s *emu)
+{
+    SDL_Event event;
+    bool open = true;
+
+    while (SDL_PollEvent(&event))
+    {
+        open &= window_handle_event(emu, &event);
+    }
+
+    return open;
+}
+
+/**
+ * @brief Sleeps until a deadline, handling SDL events as they arrive
+ *
+ * Input reaches the emulation as soon as it happens, without polling.
+ *
+ * @param emu emulation thread state
+ * @param deadline performance counter value to wait for
+ * @return false if the window was closed
+ */
+static bool window_wait_events(struct window_emu_s *emu, uint64_t deadline)
+{
+    SDL_Event event;
+    uint32_t ms;
+
+    while ((ms = ms_until(deadline)) != 0)
+    {
+        if (SDL_WaitEventTimeout(&event, ms) && !window_handle_event(emu, &event))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Copies a processed frame into the streaming texture
+ *
+ * The texture is recreated when the frame size changes, e.g. after a
+ * scaler was toggled. It is always stretched over the whole window.
+ *
+ * @param renderer renderer of the window
+ * @param texture current texture
+ * @param size width and height of the current texture, updated
+ * @param frame frame to show
+ * @return SDL_Texture* texture to present, NULL on failure
+ */
+static SDL_Texture *window_upload(SDL_Renderer *renderer, SDL_Texture *texture, int size[2],
+                                  const struct post_frame_s *frame)
+{
+    void *pixels;
+    int pitch;
+
+    if (!texture || size[0] != (int)frame->width || size[1] != (int)frame->height)
+    {
+        if (texture)
+            SDL_DestroyTexture(texture);
+
+        texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING,
+                                    frame->width, frame->height);
+        if (!texture)
+        {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't create texture: %s", SDL_GetError());
+            return NULL;
+        }
+
+        size[0] = frame->width;
+        size[1] = frame->height;
+    }
+
+    if (SDL_LockTexture(texture, NULL, &pixels, &pitch) == 0)
+    {
+        for (uint32_t y = 0; y < frame->height; y++)
+            memcpy((uint8_t *)pixels + y * pitch, &frame->pixels[y * frame->width], frame->width * sizeof(uint32_t));
+
+        SDL_UnlockTexture(texture);
+    }
+
+    return texture;
+}
+
+/**
+ * @brief Runs the emulation in a window until it is closed
+ *
+ * @param gb gameboy state struct
+ * @param opts frontend options
+ * @param keep_running cleared (e.g. by a signal handler) to stop
+ * @return int exit code
+ */
+int window_run(struct gb_s *gb, const struct window_opts_s *opts, volatile sig_atomic_t *keep_running)
+{
+    SDL_Window *window;
+    SDL_Renderer *renderer;
+    SDL_Texture *texture = NULL;
+    int texture_size[2] = {0, 0};
+
+    if (SDL_Init(SDL_INIT_VIDEO) < 0)
+    {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't initialize SDL: %s", SDL_GetError());
+        return 3;
+    }
+
+    window = SDL_CreateWindow("nyanGBE", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+                              GB_LCD_WIDTH * WINDOW_SCALE, GB_LCD_HEIGHT * WINDOW_SCALE, SDL_WINDOW_RESIZABLE);
+    if (!window)
+    {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't create window: %s", SDL_GetError());
+        return 3;
+    }
+
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | (opts->vsync ? SDL_RENDERER_PRESENTVSYNC : 0));
+    if (!renderer)
+    {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't create renderer: %s", SDL_GetError());
+        return 3;
+    }
+
+    SDL_RenderSetLogicalSize(renderer, GB_LCD_WIDTH, GB_LCD_HEIGHT);
+
+    static struct window_emu_s emu;
+    memset(&emu, 0, sizeof(emu));
+    emu.gb = gb;
+    emu.opts = opts;
+    emu.base_speed = opts->speed;
+    atomic_init(&emu.speed, opts->speed);
+
+    if (tribuf_init(&emu.frames, GB_LCD_WIDTH * GB_LCD_HEIGHT) != 0 ||
+        spsc_init(&emu.input, sizeof(struct joypad_event_s), INPUT_QUEUE_SIZE) != 0)
+    {
+        printf("Could not allocate frontend buffers\n");
+        return EXIT_FAILURE;
+    }
+
+    if (opts->run_ahead && !(emu.snapshot = malloc(sizeof(*emu.snapshot))))
+    {
+        printf("Could not allocate run-ahead state\n");
+        return EXIT_FAILURE;
+    }
+
+    if (post_start(&emu.post, &opts->post, &emu.frames) != 0)
+        return EXIT_FAILURE;
+
+    if (opts->audio_latency && audio_out_open(&emu.audio, opts->audio_latency) != 0)
+        printf("Continuing without audio\n");
+
+    if (pthread_create(&emu.thread, NULL, window_emu_main, &emu) != 0)
+    {
+        printf("Could not start emulation thread\n");
+        return EXIT_FAILURE;
+    }
+
+    uint64_t freq = SDL_GetPerformanceFrequency();
+    uint64_t frame_ticks = freq * GB_FRAME_CYCLES / GB_CLOCK_SPEED_HZ;
+    uint64_t deadline = SDL_GetPerformanceCounter();
+    struct frame_stats_s stats = {.start = deadline, .clock = gb->clock, .instructions = gb->instructions};
+
+    while (*keep_running)
+    {
+        uint64_t start = SDL_GetPerformanceCounter();
+
+        if (!window_poll_events(&emu))
+            break;
+
+        if (tribuf_acquire(&emu.post.output))
+        {
+            texture = window_upload(renderer, texture, texture_size,
+                                    (const struct post_frame_s *)tribuf_front(&emu.post.output));
+            if (!texture)
+                break;
+        }
+
+        SDL_RenderClear(renderer);
+        if (texture)
+            SDL_RenderCopy(renderer, texture, NULL, NULL);
+
+        uint64_t present_start = SDL_GetPerformanceCounter();
+
+        SDL_RenderPresent(renderer);
+
+        if (!opts->vsync)
+        {
+            next_deadline(&deadline, frame_ticks);
+            if (!window_wait_events(&emu, deadline))
+                break;
+        }
+
+        uint64_t end = SDL_GetPerformanceCounter();
+
+        stats.host += present_start - start;
+        stats.present += end - present_start;
+        stats.frames++;
+        if (end - stats.start >= freq)
+            stats_report(&stats, &emu, window, end);
+    }
+
+    atomic_store(&emu.quit, true);
+    pthread_join(emu.thread, NULL);
+    post_stop(&emu.post);
+
+    audio_out_close(&emu.audio);
+    free(emu.snapshot);
+    spsc_free(&emu.input);
+    tribuf_free(&emu.frames);
+
+    if (texture)
+        SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+
+    SDL_Quit();
+
+    return EXIT_SUCCESS;
+}
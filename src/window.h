@@ -0,0 +1,23 @@
+#pragma once
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include "gb.h"
+#include "post.h"
+#include "shm_fb.h"
+
+/* Windowed frontend options */
+struct window_opts_s
+{
+    bool vsync;               // Pace presentation with the display instead of a timer
+    unsigned speed;           // Multiple of the native speed, 0 for uncapped
+    unsigned frameskip;       // Frames not rendered after each rendered one while uncapped
+    unsigned run_ahead;       // Frames to run ahead, 0 to disable
+    unsigned audio_latency;   // Target audio buffer fill in ms, 0 to disable audio
+    struct post_chain_s post; // Post-processing stages
+    FILE *log_file;           // Instruction log, NULL to disable
+    struct shm_fb_s *shm;     // Frame export ring, NULL to disable
+};
+
+int window_run(struct gb_s *gb, const struct window_opts_s *opts, volatile sig_atomic_t *keep_running);